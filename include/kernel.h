@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <stdarg.h>
+#include <lock.h>
 
 #define TRUE   1
 #define FALSE  0
@@ -86,12 +87,32 @@ void wprintf(WINDOW* wnd, const char* fmt, ...);
 
 void kprintf(const char* fmt, ...);
 
+void panic_printf(WINDOW* wnd, const char* fmt, ...);
+
 
 /*=====>>> process.c <<<====================================================*/
 
+/*
+ * Number of statically allocated PCB's. More PCB's are allocated from
+ * the heap in slabs of PCB_SLAB_SIZE when these are used up.
+ */
 #define MAX_PROCS		20
 
-#define MAX_READY_QUEUES	8
+#define PCB_SLAB_SIZE		32
+
+#define DEFAULT_STACK_SIZE	(16 * 1024)
+
+#define MIN_STACK_SIZE		1024
+
+#define MAX_READY_QUEUES	64
+
+/*
+ * Real-time processes run at the top priority level, which is scheduled
+ * earliest deadline first instead of round robin.
+ */
+#define RT_PRIORITY		(MAX_READY_QUEUES - 1)
+
+#define DEFAULT_TIME_SLICE	4
 
 #define STATE_READY             0
 
@@ -107,12 +128,47 @@ void kprintf(const char* fmt, ...);
 
 #define STATE_INTR_BLOCKED      6
 
+#define STATE_SLEEPING          7
+
+#define STATE_WAIT_BLOCKED      8
+
+#define STATE_MUTEX_BLOCKED     9
+
+#define STATE_SEM_BLOCKED       10
+
+#define STATE_COND_BLOCKED      11
+
+/*
+ * Why a blocked process was made ready again.
+ */
+#define WAKE_NORMAL             0
+
+#define WAKE_TIMEOUT            1
+
+#define WAKE_PEER_EXITED        2
+
+/*
+ * Layout of the context saved at esp of a suspended process: a full
+ * interrupt frame, or only the callee-saved registers left by switch_to().
+ */
+#define CONTEXT_IRET            0
+
+#define CONTEXT_SWITCH          1
+
+/*
+ * Or'ed to the context passed to switch_stack(): call finish_switch()
+ * once the new stack is in use.
+ */
+#define CONTEXT_FINISH          2
+
 #define MAGIC_PCB 0x4321dcba
 
 struct _PORTPORT_DEF;
 
 typedef struct _PORT_DEF* PORT;
 
+struct _MUTEX;
+
 struct _PCB;
 
 typedef struct _PCB PCB;
@@ -124,12 +180,38 @@ struct _PCB {
     unsigned       magic;
     unsigned       used;
     unsigned short priority;
+    unsigned short base_priority;
     unsigned short state;
+    unsigned short quantum;
     MEM_ADDR       esp;
+    unsigned       context;
+    int            cpu;               /* CPU running it, or NO_CPU */
+    int            lock_depth;        /* Kernel lock depth while switched out */
     PROCESS        param_proc;
     void*          param_data;
     PORT           first_port;
+    PORT           pending_ports;
+    PORT           receive_port;
+    PORT           blocked_port;
     PROCESS        next_blocked;
+    PROCESS        waiting_on;
+    PROCESS        first_client;
+    struct _MUTEX* held_mutexes;
+    int            timeout;
+    int            wake_reason;
+    PROCESS        next_timeout;
+    PROCESS        prev_timeout;
+    int            rt_period;         /* 0 if not real-time */
+    int            rt_deadline;       /* Relative to the release */
+    int            rt_density;        /* Per mille of the CPU */
+    unsigned       rt_release;        /* Tick of the current release */
+    unsigned       deadline;          /* Tick of the current deadline */
+    unsigned       missed_deadlines;
+    MEM_ADDR       stack_base;        /* Heap stack or 0 */
+    int            stack_size;
+    PROCESS        next_slot;         /* Next PCB slot, used or not */
+    PROCESS        next_zombie;
+    PROCESS        parent;
     PROCESS        next;
     PROCESS        prev;
     char*          name;
@@ -144,10 +226,26 @@ PORT create_process(void (*new_proc) (PROCESS, PARAM),
 		    PARAM param,
 		    char *proc_name);
 
+PORT create_process_with_stack(void (*new_proc) (PROCESS, PARAM),
+			       int prio,
+			       PARAM param,
+			       char *proc_name,
+			       int stack_size);
+
+void wait(PROCESS child);
+
+void reap_zombies();
+
+void add_zombie(PROCESS proc);
+
+PROCESS first_pcb();
+
+PROCESS next_pcb(PROCESS p);
+
 
-#ifdef XXX
 PROCESS fork();
-#endif
+
+void fork_child();
 
 void print_process(WINDOW* wnd, PROCESS p);
 
@@ -159,34 +257,112 @@ void init_process();
 
 /*=====>>> dispatch.c <<<===================================================*/
 
+#define PRIO_BITMAP_WORDS	((MAX_READY_QUEUES + 31) / 32)
+
+/*
+ * Two-level priority bitmap. Bit (prio % 32) of bits[prio / 32] is set
+ * when priority prio is present; bit i of groups is set whenever
+ * bits[i] is non-zero. Both levels are searched with bsr.
+ */
+typedef struct {
+    unsigned groups;
+    unsigned bits[PRIO_BITMAP_WORDS];
+} PRIO_BITMAP;
+
+#ifdef SMP
+#define active_proc (((CPU __seg_gs *) 0)->current)
+#else
 extern PROCESS active_proc;
+#endif
 
 extern PCB* ready_queue[];
 
+extern PRIO_BITMAP ready_procs;
+
+int find_last_set(unsigned word);
+
+void clear_prio_bitmap(PRIO_BITMAP* map);
+
+void set_prio_bit(PRIO_BITMAP* map, int prio);
+
+void clear_prio_bit(PRIO_BITMAP* map, int prio);
+
+int highest_prio_bit(PRIO_BITMAP* map);
+
+int find_first_set(unsigned word);
+
+int next_prio_bit_above(PRIO_BITMAP* map, int prio);
+
+BOOL is_only_ready(PROCESS proc);
+
+void set_time_slice(int prio, int ticks);
+
+BOOL account_tick();
+
 PROCESS dispatcher();
 
+PROCESS check_preemption();
+
 void add_ready_queue (PROCESS proc);
 
 void remove_ready_queue (PROCESS proc);
 
+void replace_ready_queue (PROCESS old_proc, PROCESS new_proc);
+
+void change_priority (PROCESS proc, int prio);
+
+extern int rt_load;
+
+extern unsigned missed_deadlines;
+
+BOOL set_realtime (int period, int deadline, int budget);
+
+void wait_for_next_period ();
+
 void become_zombie();
 
+/* Implemented in startup.s */
+void switch_stack(MEM_ADDR* save_esp, MEM_ADDR new_esp, unsigned new_context);
+
+void switch_to(PROCESS prev, PROCESS next);
+
+void resume_active_proc();
+
+void finish_switch();
+
+void schedule();
+
 void resign();
 
+void resign_to(PROCESS proc);
+
 void init_dispatcher();
 
 
 /*=====>>> null.c <<<=======================================================*/
 
+void null_process(PROCESS self, PARAM param);
+
 void init_null_process();
 
 
 /*=====>>> ipc.c <<<========================================================*/
 
+/*
+ * Number of statically allocated ports. More ports are allocated from
+ * the heap in slabs of PORT_SLAB_SIZE when these are used up.
+ */
 #define MAX_PORTS	(MAX_PROCS * 2)
 
+#define PORT_SLAB_SIZE	(PCB_SLAB_SIZE * 2)
+
 #define MAGIC_PORT  0x1234abcd
 
+typedef struct _MSG_SLOT {
+    PROCESS   sender;            /* Process that sent the message */
+    void*     data;              /* Original data pointer of message() */
+} MSG_SLOT;
+
 typedef struct _PORT_DEF {
     unsigned  magic;
     unsigned  used;              /* Port slot used? */
@@ -194,6 +370,17 @@ typedef struct _PORT_DEF {
     PROCESS   owner;             /* Owner of this port */
     PROCESS   blocked_list_head; /* First local blocked process */
     PROCESS   blocked_list_tail; /* Last local blocked process */
+    PROCESS*  prio_tail;         /* Last blocked process per priority,
+                                    NULL if the blocked list is FIFO */
+    PRIO_BITMAP blocked_prios;   /* Priorities present in prio_tail */
+    char*     queue;             /* Ring of buffered messages or NULL */
+    int       queue_slots;       /* Number of slots in the ring */
+    int       queue_slot_size;   /* Bytes per slot incl. MSG_SLOT */
+    int       queue_head;        /* Slot of the oldest message */
+    int       queue_count;       /* Number of buffered messages */
+    BOOL      pending;           /* On owner's list of pending ports? */
+    struct _PORT_DEF *next_pending;    /* Next pending port of owner */
+    struct _PORT_DEF *prev_pending;    /* Previous pending port of owner */
     struct _PORT_DEF *next;            /* Next port */
 } PORT_DEF;
 
@@ -205,24 +392,74 @@ void open_port (PORT port);
 
 void close_port (PORT port);
 
+void create_message_queue (PORT port, int num_msgs, int msg_size);
+
+void order_port_by_priority (PORT port);
+
 void send (PORT dest_port, void* data);
 
+BOOL send_timeout (PORT dest_port, void* data, int ticks);
+
 void message (PORT dest_port, void* data);
 
+BOOL try_message (PORT dest_port, void* data);
+
+BOOL post_message (PORT dest_port, void* data);
+
 void* receive (PROCESS* sender);
 
+void* receive_from (PORT port, PROCESS* sender);
+
+void* receive_timeout (PROCESS* sender, int ticks);
+
+void* receive_from_timeout (PORT port, PROCESS* sender, int ticks);
+
+void remove_from_send_blocked_list (PORT port, PROCESS proc);
+
 void reply (PROCESS sender);
 
+void* call (PORT dest_port, void* data);
+
+void* reply_and_receive (PROCESS sender, PROCESS* next_sender);
+
+void release_ports (PROCESS proc);
+
+void inherit_priority (PROCESS proc, int prio);
+
+void update_priority (PROCESS proc);
+
+void remove_client (PROCESS server, PROCESS client);
+
 void init_ipc();
 
 
 /*=====>>> intr.c <<<=======================================================*/
 
+#ifdef SMP
+#define INTR_LOCK()		lock_kernel();
+#define INTR_UNLOCK()		unlock_kernel();
+#else
+#define INTR_LOCK()
+#define INTR_UNLOCK()
+#endif
+
+#ifdef TRACE_INTR_LATENCY
+#define INTR_TRACE_OFF(save)	trace_intr_off(save, __FILE__, __LINE__);
+#define INTR_TRACE_ON(save)	trace_intr_on(save, __FILE__, __LINE__);
+#else
+#define INTR_TRACE_OFF(save)
+#define INTR_TRACE_ON(save)
+#endif
+
 #define DISABLE_INTR(save)	asm ("pushfl");                   \
                                 asm ("popl %0" : "=r" (save) : ); \
-				asm ("cli");
+				asm ("cli");                      \
+				INTR_LOCK()                       \
+				INTR_TRACE_OFF(save)
 
-#define ENABLE_INTR(save) 	asm ("pushl %0" : : "m" (save)); \
+#define ENABLE_INTR(save) 	INTR_TRACE_ON(save)               \
+				INTR_UNLOCK()                     \
+				asm ("pushl %0" : : "m" (save)); \
 				asm ("popfl");
 
 typedef struct 
@@ -246,11 +483,64 @@ typedef struct
 
 #define IDT_ENTRY_SIZE 8
 
+/* The two 8259 PICs are remapped to vectors IRQ_BASE..IRQ_BASE+15 */
+#define IRQ_BASE 0x60
+
+#define NUM_IRQS 16
+
+#define IRQ_VECTOR(irq) (IRQ_BASE + (irq))
+
+/* Entry stubs generated in startup.s */
+extern void (*irq_stubs[]) (void);
+
 extern BOOL interrupts_initialized;
 
+extern PROCESS interrupt_table[];
+
+extern IDT idt[];
+
+void load_idt (IDT* base);
+
 void init_idt_entry (int intr_no, void (*isr) (void));
 
-void wait_for_interrupt (int intr_no);
+/*
+ * Per IRQ line: delivered counts wake-ups and messages, coalesced the
+ * extra IRQs folded into one wake-up, lost the IRQs nobody took.
+ */
+typedef struct {
+    unsigned delivered;
+    unsigned coalesced;
+    unsigned lost;
+} IRQ_STATS;
+
+extern IRQ_STATS irq_stats[];
+
+/*
+ * Deferred work of an interrupt handler. Runs at the end of the
+ * outermost IRQ with interrupts enabled, must not block.
+ */
+typedef struct _TASKLET {
+    void            (*func) (void*);
+    void*           data;
+    BOOL            scheduled;
+    struct _TASKLET* next;
+} TASKLET;
+
+void init_tasklet (TASKLET* t, void (*func) (void*), void* data);
+
+void schedule_tasklet (TASKLET* t);
+
+void isr_timer (int intr_no);
+
+int wait_for_interrupt (int intr_no);
+
+int wait_for_interrupt_timeout (int intr_no, int ticks);
+
+void register_irq_handler (int intr_no, void (*handler) (int));
+
+void register_irq_port (int intr_no, PORT port);
+
+void unregister_irq (int intr_no);
 
 void init_interrupts ();
 
@@ -259,6 +549,29 @@ void init_interrupts ();
 
 #define TIMER_IRQ   0x60
 
+/*
+ * Rate of the timer interrupt in Hz. The 8253 PIT divides its input
+ * clock of PIT_FREQUENCY Hz by a 16 bit divisor, so TIMER_HZ must be
+ * at least 19.
+ */
+#ifndef TIMER_HZ
+#define TIMER_HZ        1000
+#endif
+
+#define PIT_FREQUENCY   1193182
+
+#define PIT_DIVISOR     ((PIT_FREQUENCY + TIMER_HZ / 2) / TIMER_HZ)
+
+#if PIT_DIVISOR < 1 || PIT_DIVISOR > 65535
+#error "TIMER_HZ out of range for the 8253 PIT"
+#endif
+
+/* Actual length of one tick, which differs slightly from 1/TIMER_HZ */
+#define NS_PER_TICK     ((unsigned) (PIT_DIVISOR * 1000000000ULL / PIT_FREQUENCY))
+
+/* Number of ticks that cover at least ms milliseconds */
+#define MS_TO_TICKS(ms) (((ms) * TIMER_HZ + 999) / 1000)
+
 extern PORT timer_port;
 
 struct _Timer_Message 
@@ -270,6 +583,32 @@ typedef struct _Timer_Message Timer_Message;
 
 void sleep(int num_of_ticks);
 
+void add_timeout(PROCESS proc, int ticks);
+
+void cancel_timeout(PROCESS proc);
+
+void check_timeouts(int ticks);
+
+void update_clock(int ticks);
+
+extern unsigned cycles_per_tick;
+
+unsigned long long read_tsc();
+
+unsigned mul_div(unsigned a, unsigned b, unsigned c);
+
+void start_tickless();
+
+BOOL end_tickless();
+
+void leave_tickless();
+
+unsigned get_ticks();
+
+unsigned long long get_time_ns();
+
+void init_timeouts();
+
 void init_timer();
 
 
@@ -303,6 +642,8 @@ typedef struct _COM_Message COM_Message;
 
 void init_com();
 
+void send_cmd_to_com(char *cmd);
+
 
 /*=====>>> keyb.c <<<====================================================*/
 
@@ -385,4 +726,193 @@ void init_wm();
 void start_pong();
 
 
+/*=====>>> apic.c <<<=====================================================*/
+
+#define IOAPIC_BASE_DEFAULT     0xFEC00000
+
+#define APIC_SPURIOUS_VECTOR    0xFF
+
+extern BOOL apic_active;
+
+extern BOOL apic_timer_active;
+
+BOOL init_apic();
+
+void apic_eoi();
+
+BOOL start_apic_timer();
+
+void apic_send_ipi(unsigned icr);
+
+void init_ap_apic();
+
+void pit_delay(unsigned count);
+
+
+/*=====>>> fiber.c <<<=====================================================*/
+
+#define FIBER_STACK_SIZE      1024
+#define MIN_FIBER_STACK_SIZE  256
+
+#define FIBER_READY     0
+#define FIBER_RUNNING   1
+#define FIBER_SLEEPING  2
+#define FIBER_DONE      3
+
+typedef struct _FIBER* FIBER;
+
+typedef struct {
+    FIBER       ready_head;
+    FIBER       ready_tail;
+    FIBER       sleeping;
+    MEM_ADDR    esp;
+    int         num_fibers;
+} FIBER_HOST;
+
+struct _FIBER {
+    unsigned     magic;
+    int          state;
+    MEM_ADDR     esp;
+    MEM_ADDR     stack;
+    int          stack_size;
+    unsigned     wake_tick;
+    void         (*entry) (FIBER, PARAM);
+    PARAM        param;
+    FIBER_HOST*  host;
+    FIBER        next;
+};
+
+void init_fiber_host(FIBER_HOST* host);
+FIBER create_fiber(FIBER_HOST* host, void (*entry) (FIBER, PARAM),
+                   PARAM param, int stack_size);
+void run_fibers(FIBER_HOST* host);
+void fiber_yield(FIBER self);
+void fiber_sleep(FIBER self, int num_of_ticks);
+void fiber_message(FIBER self, PORT dest_port, void* data);
+void fiber_exit(FIBER self);
+void fiber_switch(MEM_ADDR* save_esp, MEM_ADDR new_esp);
+
+
+/*=====>>> sync.c <<<======================================================*/
+
+/*
+ * Processes blocked on a mutex, semaphore or condition variable, in
+ * FIFO order, linked through next_blocked.
+ */
+typedef struct {
+    PROCESS     head;
+    PROCESS     tail;
+} WAIT_LIST;
+
+typedef struct _MUTEX {
+    PROCESS         owner;            /* NULL if unlocked */
+    WAIT_LIST       waiting;
+    struct _MUTEX*  next_held;        /* Next mutex held by owner */
+} MUTEX;
+
+#define MUTEX_INIT      { NULL, { NULL, NULL }, NULL }
+
+typedef struct {
+    int         count;
+    WAIT_LIST   waiting;
+} SEMAPHORE;
+
+typedef struct {
+    WAIT_LIST   waiting;
+} CONDITION;
+
+void init_mutex(MUTEX* mutex);
+void mutex_lock(MUTEX* mutex);
+BOOL mutex_trylock(MUTEX* mutex);
+void mutex_unlock(MUTEX* mutex);
+void abandon_mutexes(PROCESS proc);
+void forget_mutexes(PROCESS proc);
+void init_semaphore(SEMAPHORE* sem, int count);
+void semaphore_wait(SEMAPHORE* sem);
+void semaphore_signal(SEMAPHORE* sem);
+void init_condition(CONDITION* cond);
+void condition_wait(CONDITION* cond, MUTEX* mutex);
+void condition_signal(CONDITION* cond);
+void condition_broadcast(CONDITION* cond);
+
+
+/*=====>>> smp.c <<<=======================================================*/
+
+#define MAX_CPUS                8
+
+#define BOOT_CPU                0
+
+#define NO_CPU                  (-1)
+
+/* Physical page the application processors start in; below KERNEL_BASE */
+#define AP_TRAMPOLINE           0x3000
+
+#define AP_BOOT_STACK_SIZE      1024
+
+/* Selector of the GDT entry whose base is cpus[cpu] */
+#define CPU_SELECTOR(cpu)       (0x18 + 8 * (cpu))
+
+/*
+ * Per-CPU data. Each CPU has its %gs segment based at its own entry, so
+ * active_proc and this_cpu() are a single %gs-relative access that
+ * cannot be torn by a migration to another CPU.
+ */
+typedef struct _CPU {
+    struct _CPU*   self;
+    int            index;
+    PROCESS        current;           /* active_proc of this CPU */
+    PROCESS        idle;              /* Runs when no process is eligible */
+    PROCESS        interrupted;       /* Process the outermost IRQ stopped */
+    int            irq_nesting;
+    int            lock_depth;        /* Nesting of lock_kernel() */
+} CPU;
+
+#define this_cpu()  (((CPU __seg_gs *) 0)->self)
+
+extern CPU cpus[];
+
+extern int num_cpus;
+
+void lock_kernel();
+
+void unlock_kernel();
+
+void init_smp();
+
+void start_aps();
+
+
+/*=====>>> latency.c <<<====================================================*/
+
+/*
+ * Number of DISABLE_INTR() call sites with the longest interrupts-off
+ * sections that are kept when the kernel is built with
+ * -DTRACE_INTR_LATENCY.
+ */
+#define INTR_LATENCY_RECORDS    10
+
+typedef struct {
+    const char*  off_file;        /* DISABLE_INTR() that started it */
+    int          off_line;
+    const char*  on_file;         /* ENABLE_INTR() that ended the longest */
+    int          on_line;
+    unsigned     max_cycles;
+    unsigned     count;
+} INTR_LATENCY;
+
+void trace_intr_off(int flags, const char* file, int line);
+
+void trace_intr_on(int flags, const char* file, int line);
+
+void trace_intr_irq();
+
+int get_intr_latency(INTR_LATENCY* records);
+
+void reset_intr_latency();
+
+void print_intr_latency(int window_id);
+
+void dump_intr_latency();
+
+
 #endif
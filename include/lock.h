@@ -1,6 +1,23 @@
 #ifndef __LOCK_H__
 #define __LOCK_H__
 
+/*
+ * Busy-waiting lock for data shared between CPUs. Holders must not be
+ * interrupted by code that takes the same lock, i.e. interrupts have
+ * to be disabled on the local CPU while it is held.
+ */
+typedef volatile unsigned SPINLOCK;
+
+#define SPINLOCK_INIT   0
+
+void spin_lock(SPINLOCK* lock);
+
+void spin_unlock(SPINLOCK* lock);
+
+/*
+ * With SMP, DISABLE_INTR() also takes the kernel lock, so CPU_LOCK()
+ * excludes the other CPUs as well as interrupts.
+ */
 #define CPU_LOCK() volatile int _flags; DISABLE_INTR(_flags)
 #define CPU_UNLOCK() ENABLE_INTR(_flags)
 
@@ -55,6 +55,8 @@ void test_create_process_3();
 void test_dispatcher_1();
 void test_dispatcher_2();
 void test_dispatcher_3();
+void test_dispatcher_4();
+void test_dispatcher_5();
 
 void test_resign_1();
 void test_resign_2();
@@ -69,13 +71,27 @@ void test_ipc_3();
 void test_ipc_4();
 void test_ipc_5();
 void test_ipc_6();
+void test_ipc_7();
+void test_ipc_8();
+void test_ipc_9();
+void test_ipc_10();
+void test_ipc_11();
 
 void test_isr_1();
 void test_isr_2();
 void test_isr_3();
+void test_isr_4();
 
 void test_timer_1();
+void test_timer_2();
 void test_com_1();
 void test_fork_1();
+void test_process_1();
+void test_process_2();
+void test_process_3();
+
+void test_sync_1();
+void test_sync_2();
+void test_sync_3();
 
 #endif
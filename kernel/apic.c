@@ -0,0 +1,388 @@
+#include <kernel.h>
+
+/*
+ * Local APIC and I/O APIC support. When enabled, the 8259 pair is
+ * masked, the 16 ISA IRQs are routed through the I/O APIC to the same
+ * vectors IRQ_BASE..IRQ_BASE+15, and EOIs become a single MMIO write.
+ * The local APIC timer can replace the PIT as the tick source.
+ */
+
+BOOL            apic_active = FALSE;
+BOOL            apic_timer_active = FALSE;
+
+static MEM_ADDR apic_base;
+static MEM_ADDR ioapic_base;
+static BOOL     apic_tsc_deadline;
+static unsigned tsc_per_tick;
+static unsigned apic_per_tick;
+static unsigned long long next_deadline;
+
+/* Local APIC registers */
+#define APIC_ID         0x020
+#define APIC_TPR        0x080
+#define APIC_EOI        0x0B0
+#define APIC_SVR        0x0F0
+#define APIC_ICR_LOW    0x300
+#define APIC_ICR_HIGH   0x310
+#define APIC_LVT_TIMER  0x320
+#define APIC_LVT_LINT0  0x350
+#define APIC_LVT_LINT1  0x360
+#define APIC_LVT_ERROR  0x370
+#define APIC_TIMER_INIT 0x380
+#define APIC_TIMER_CUR  0x390
+#define APIC_TIMER_DIV  0x3E0
+
+#define APIC_ENABLE             0x100
+#define APIC_MASKED             0x10000
+#define APIC_NMI                0x400
+#define APIC_TIMER_PERIODIC     0x20000
+#define APIC_TIMER_TSC_DEADLINE 0x40000
+#define APIC_ICR_PENDING        0x1000
+
+/* I/O APIC registers */
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+#define IOAPIC_VERSION  0x01
+#define IOAPIC_REDTBL   0x10
+
+/* Model specific registers */
+#define MSR_APIC_BASE     0x1B
+#define MSR_TSC_DEADLINE  0x6E0
+
+/* CPUID(1) feature bits */
+#define CPUID_EDX_TSC           (1 << 4)
+#define CPUID_EDX_MSR           (1 << 5)
+#define CPUID_EDX_APIC          (1 << 9)
+#define CPUID_ECX_TSC_DEADLINE  (1 << 24)
+
+/*
+ * Number of PIT ticks the APIC timer is calibrated against. The count
+ * must fit into the 16 bits of PIT channel 2.
+ */
+#define APIC_CALIBRATION_TICKS \
+    (65535 / PIT_DIVISOR < 10 ? 65535 / PIT_DIVISOR : 10)
+
+
+unsigned apic_read(int reg)
+{
+    return *((volatile unsigned *) (apic_base + reg));
+}
+
+
+void apic_write(int reg, unsigned value)
+{
+    *((volatile unsigned *) (apic_base + reg)) = value;
+}
+
+
+unsigned ioapic_read(int reg)
+{
+    *((volatile unsigned *) (ioapic_base + IOAPIC_REGSEL)) = reg;
+    return *((volatile unsigned *) (ioapic_base + IOAPIC_WINDOW));
+}
+
+
+void ioapic_write(int reg, unsigned value)
+{
+    *((volatile unsigned *) (ioapic_base + IOAPIC_REGSEL)) = reg;
+    *((volatile unsigned *) (ioapic_base + IOAPIC_WINDOW)) = value;
+}
+
+
+unsigned long long read_msr(unsigned msr)
+{
+    unsigned long long value;
+
+    asm volatile ("rdmsr":"=A" (value):"c"(msr));
+    return value;
+}
+
+
+void write_msr(unsigned msr, unsigned long long value)
+{
+    asm volatile ("wrmsr"::"c" (msr), "A"(value));
+}
+
+
+/*
+ * Returns TRUE if the CPU knows the CPUID instruction, i.e. if the ID
+ * bit of EFLAGS can be toggled.
+ */
+BOOL has_cpuid()
+{
+    unsigned        changed;
+
+    asm("pushfl\n\t"
+        "popl %%eax\n\t"
+        "movl %%eax,%%ecx\n\t"
+        "xorl $0x200000,%%eax\n\t"
+        "pushl %%eax\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %%eax\n\t"
+        "pushl %%ecx\n\t"
+        "popfl\n\t" "xorl %%ecx,%%eax":"=a"(changed)::"ecx", "cc");
+    return (changed & 0x200000) != 0;
+}
+
+
+void cpuid(unsigned leaf, unsigned *ecx, unsigned *edx)
+{
+    unsigned        eax,
+                    ebx;
+
+    asm volatile ("cpuid":"=a" (eax), "=b"(ebx), "=c"(*ecx),
+                  "=d"(*edx):"0"(leaf));
+}
+
+
+void apic_eoi()
+{
+    apic_write(APIC_EOI, 0);
+}
+
+
+/*
+ * The local APIC does not expect an EOI for its spurious vector.
+ */
+void apic_spurious_int()
+{
+    asm("iret");
+}
+
+
+/*
+ * Routes ISA IRQ irq to I/O APIC pin pin: edge triggered, active high,
+ * fixed delivery to the local APIC of this CPU.
+ */
+void ioapic_route(int irq, int pin, BOOL masked)
+{
+    unsigned        low = IRQ_VECTOR(irq);
+
+    if (masked)
+        low |= APIC_MASKED;
+    ioapic_write(IOAPIC_REDTBL + 2 * pin + 1,
+                 apic_read(APIC_ID) & 0xff000000);
+    ioapic_write(IOAPIC_REDTBL + 2 * pin, low);
+}
+
+
+/*
+ * init_apic
+ *----------------------------------------------------------------------------
+ * Switches interrupt delivery from the 8259 pair to the APICs if the CPU
+ * has a local APIC and an I/O APIC answers at its default address.
+ * Returns FALSE and leaves the 8259 in charge otherwise.
+ */
+
+BOOL init_apic()
+{
+    unsigned        ecx,
+                    edx;
+    int             pins;
+    int             i;
+
+    apic_active = FALSE;
+    if (!has_cpuid())
+        return FALSE;
+    cpuid(1, &ecx, &edx);
+    if ((edx & (CPUID_EDX_APIC | CPUID_EDX_MSR | CPUID_EDX_TSC)) !=
+        (CPUID_EDX_APIC | CPUID_EDX_MSR | CPUID_EDX_TSC))
+        return FALSE;
+    apic_tsc_deadline = (ecx & CPUID_ECX_TSC_DEADLINE) != 0;
+
+    /*
+     * There is no ACPI or MP table parser, so the I/O APIC is expected
+     * at its default address, as in QEMU and Bochs.
+     */
+    ioapic_base = IOAPIC_BASE_DEFAULT;
+    if (ioapic_read(IOAPIC_VERSION) == 0xffffffff)
+        return FALSE;
+    pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xff) + 1;
+    if (pins < NUM_IRQS)
+        return FALSE;
+
+    /* Enable the local APIC */
+    apic_base = (MEM_ADDR) read_msr(MSR_APIC_BASE) & 0xfffff000;
+    write_msr(MSR_APIC_BASE, apic_base | 0x800);
+    init_idt_entry(APIC_SPURIOUS_VECTOR, apic_spurious_int);
+    apic_write(APIC_SVR, APIC_ENABLE | APIC_SPURIOUS_VECTOR);
+    apic_write(APIC_TPR, 0);
+    apic_write(APIC_LVT_TIMER, APIC_MASKED | TIMER_IRQ);
+    apic_write(APIC_LVT_LINT0, APIC_MASKED);
+    apic_write(APIC_LVT_LINT1, APIC_NMI);
+    apic_write(APIC_LVT_ERROR, APIC_MASKED | APIC_SPURIOUS_VECTOR);
+
+    /*
+     * Identity mapping of the ISA IRQs, except that the PIT is wired
+     * to pin 2. Pin 0 carries the 8259 and stays masked.
+     */
+    for (i = 0; i < pins; i++)
+        ioapic_write(IOAPIC_REDTBL + 2 * i, APIC_MASKED);
+    ioapic_route(0, 2, FALSE);
+    for (i = 1; i < NUM_IRQS; i++)
+        if (i != 2)
+            ioapic_route(i, i, FALSE);
+
+    /* Mask all lines of the 8259 pair */
+    outportb(0x21, 0xff);
+    outportb(0xA1, 0xff);
+
+    apic_active = TRUE;
+    return TRUE;
+}
+
+
+/*
+ * Starts channel 2 of the PIT counting down count PIT clocks. Its OUT
+ * bit in port 0x61 goes high when the count expired. count must fit
+ * into 16 bits.
+ */
+unsigned char start_pit_countdown(unsigned count)
+{
+    unsigned char   gate;
+
+    /* Gate of channel 2 off, speaker off */
+    gate = inportb(0x61) & ~0x03;
+    outportb(0x61, gate);
+    /* Channel 2, lobyte/hibyte, mode 0 */
+    outportb(0x43, 0xb0);
+    outportb(0x42, count & 0xff);
+    outportb(0x42, count >> 8);
+    outportb(0x61, gate | 0x01);
+    return gate;
+}
+
+
+/*
+ * Busy waits for count PIT clocks, at most 65535 (about 55 ms).
+ */
+void pit_delay(unsigned count)
+{
+    unsigned char   gate = start_pit_countdown(count);
+
+    while ((inportb(0x61) & 0x20) == 0);
+    outportb(0x61, gate);
+}
+
+
+/*
+ * Lets channel 2 of the PIT count down APIC_CALIBRATION_TICKS ticks and
+ * measures how far the APIC timer and the TSC advance meanwhile.
+ */
+void calibrate_apic_timer(unsigned *apic_counts, unsigned *tsc_counts)
+{
+    unsigned char   gate;
+    unsigned long long tsc;
+
+    apic_write(APIC_TIMER_DIV, 0x3);    /* Divide by 16 */
+    apic_write(APIC_LVT_TIMER, APIC_MASKED | TIMER_IRQ);
+    gate = start_pit_countdown(APIC_CALIBRATION_TICKS * PIT_DIVISOR);
+    apic_write(APIC_TIMER_INIT, 0xffffffff);
+    tsc = read_tsc();
+    /* OUT of channel 2 goes high when the count expired */
+    while ((inportb(0x61) & 0x20) == 0);
+    *apic_counts = 0xffffffff - apic_read(APIC_TIMER_CUR);
+    *tsc_counts = (unsigned) (read_tsc() - tsc);
+    apic_write(APIC_TIMER_INIT, 0);
+    outportb(0x61, gate);
+}
+
+
+/*
+ * Timer ISR in TSC-deadline mode: the deadline has to be re-armed for
+ * every tick. Deadlines are kept on a grid to avoid drift.
+ */
+void apic_timer_irq(int intr_no)
+{
+    unsigned long long now = read_tsc();
+
+    next_deadline += tsc_per_tick;
+    if (next_deadline <= now)
+        next_deadline = now + tsc_per_tick;
+    write_msr(MSR_TSC_DEADLINE, next_deadline);
+    isr_timer(intr_no);
+}
+
+
+/*
+ * start_apic_timer
+ *----------------------------------------------------------------------------
+ * Makes the local APIC timer the tick source, at TIMER_HZ. Uses
+ * TSC-deadline mode if the CPU has it, periodic mode otherwise. Returns
+ * FALSE if the APIC is not active; the PIT stays in charge then.
+ */
+
+BOOL start_apic_timer()
+{
+    unsigned        apic_counts;
+    unsigned        tsc_counts;
+    volatile int    flag;
+
+    if (!apic_active)
+        return FALSE;
+
+    DISABLE_INTR(flag);
+    calibrate_apic_timer(&apic_counts, &tsc_counts);
+    if (apic_counts < APIC_CALIBRATION_TICKS) {
+        ENABLE_INTR(flag);
+        return FALSE;
+    }
+
+    /* The PIT keeps running, but nobody listens anymore */
+    ioapic_route(0, 2, TRUE);
+    apic_per_tick = apic_counts / APIC_CALIBRATION_TICKS;
+    apic_timer_active = TRUE;
+
+    if (apic_tsc_deadline) {
+        tsc_per_tick = tsc_counts / APIC_CALIBRATION_TICKS;
+        register_irq_handler(TIMER_IRQ, apic_timer_irq);
+        apic_write(APIC_LVT_TIMER, APIC_TIMER_TSC_DEADLINE | TIMER_IRQ);
+        next_deadline = read_tsc() + tsc_per_tick;
+        write_msr(MSR_TSC_DEADLINE, next_deadline);
+    } else {
+        apic_write(APIC_TIMER_DIV, 0x3);
+        apic_write(APIC_LVT_TIMER, APIC_TIMER_PERIODIC | TIMER_IRQ);
+        apic_write(APIC_TIMER_INIT, apic_per_tick);
+    }
+    ENABLE_INTR(flag);
+    return TRUE;
+}
+
+
+/*
+ * Sends an inter-processor interrupt described by the low word of the
+ * ICR and waits until the local APIC accepted it.
+ */
+void apic_send_ipi(unsigned icr)
+{
+    apic_write(APIC_ICR_HIGH, 0);
+    apic_write(APIC_ICR_LOW, icr);
+    while (apic_read(APIC_ICR_LOW) & APIC_ICR_PENDING);
+}
+
+
+/*
+ * init_ap_apic
+ *----------------------------------------------------------------------------
+ * Enables the local APIC of an application processor. External
+ * interrupts stay with the boot processor. If the APIC timer is the tick
+ * source, the AP gets a periodic tick of the same rate, which only
+ * drives preemption on that CPU.
+ */
+
+void init_ap_apic()
+{
+    write_msr(MSR_APIC_BASE, apic_base | 0x800);
+    apic_write(APIC_SVR, APIC_ENABLE | APIC_SPURIOUS_VECTOR);
+    apic_write(APIC_TPR, 0);
+    apic_write(APIC_LVT_TIMER, APIC_MASKED | TIMER_IRQ);
+    apic_write(APIC_LVT_LINT0, APIC_MASKED);
+    apic_write(APIC_LVT_LINT1, APIC_MASKED);
+    apic_write(APIC_LVT_ERROR, APIC_MASKED | APIC_SPURIOUS_VECTOR);
+    if (apic_timer_active) {
+        apic_write(APIC_TIMER_DIV, 0x3);
+        apic_write(APIC_LVT_TIMER, APIC_TIMER_PERIODIC | TIMER_IRQ);
+        apic_write(APIC_TIMER_INIT, apic_per_tick);
+    }
+}
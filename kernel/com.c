@@ -12,6 +12,22 @@
 
 PORT            com_port;
 
+/* 
+ * Number of ticks the COM process waits for the next byte before it
+ * gives up on a reply.
+ */
+#define COM_READ_TIMEOUT MS_TO_TICKS(2200)
+
+/* 
+ * Reply of the current request. The tasklet fills it and notifies the
+ * COM process through com_rx_port. rx_buffer is NULL between requests.
+ */
+static char    *rx_buffer = NULL;
+static int      rx_count;
+static int      rx_wanted;
+static PORT     com_rx_port;
+static TASKLET  com_tasklet;
+
 
 void init_uart()
 {
@@ -32,24 +48,30 @@ void init_uart()
 
 
 
-void com_reader_process(PROCESS self, PARAM param)
+/* 
+ * Tasklet that captures the bytes received by the UART. Bytes nobody
+ * asked for are dropped.
+ */
+void com_rx(void *data)
 {
-    PORT            reply_port;
-    PROCESS         sender_proc;
-    COM_Message    *msg;
-    int             i;
-
-    reply_port = (PORT) param;
-    while (1) {
-        msg = (COM_Message *) receive(&sender_proc);
-        i = 0;
-        while (i != msg->len_input_buffer) {
-            wait_for_interrupt(COM1_IRQ);
-            msg->input_buffer[i++] = inportb(COM1_PORT);
+    BOOL            received = FALSE;
+    char            ch;
+
+    while (inportb(COM1_PORT + 5) & 1) {
+        ch = inportb(COM1_PORT);
+        if (rx_buffer != NULL && rx_count < rx_wanted) {
+            rx_buffer[rx_count++] = ch;
+            received = TRUE;
         }
-        message(reply_port, &msg);
     }
-    become_zombie();
+    if (received)
+        post_message(com_rx_port, &rx_count);
+}
+
+
+void com_irq(int intr_no)
+{
+    schedule_tasklet(&com_tasklet);
 }
 
 
@@ -68,36 +90,55 @@ void send_cmd_to_com(char *cmd)
 
 void com_process(PROCESS self, PARAM param)
 {
-    PORT            com_reader_port;
-    PORT            com_writer_port;
     PROCESS         sender_proc;
     PROCESS         recv_proc;
     COM_Message    *msg;
+    volatile int    flag;
 
-    /* create a second port for receiving messages from COM reader process 
+    /* 
+     * The tasklet reports new bytes on a second port. It stays closed so
+     * that only user requests are picked up by receive().
      */
-    com_writer_port = create_new_port(self);
-
-    /* create a port for COM reader process */
-    com_reader_port = create_process(com_reader_process, 7,
-                                     (PARAM) com_writer_port,
-                                     "COM reader");
-
+    com_rx_port = create_new_port(self);
+    close_port(com_rx_port);
+    init_tasklet(&com_tasklet, com_rx, NULL);
+    register_irq_handler(COM1_IRQ, com_irq);
+
+    msg = (COM_Message *) receive(&sender_proc);        // receive a
+    // message from
+    // user process
     while (42) {
-        open_port(com_port);
-        close_port(com_writer_port);
-        msg = (COM_Message *) receive(&sender_proc);    // receive a
-        // message from
-        // user process
-        message(com_reader_port, msg);
+        DISABLE_INTR(flag);
+        rx_buffer = msg->input_buffer;
+        rx_count = 0;
+        rx_wanted = msg->len_input_buffer;
+        ENABLE_INTR(flag);
+
         send_cmd_to_com(msg->output_buffer);
 
-        close_port(com_port);
-        open_port(com_writer_port);
-        receive(&recv_proc);    // receive a message from COM reader
-        // process
-        /* assert (recv_proc == com_reader_proc); */
-        reply(sender_proc);
+        /* 
+         * Interrupts stay disabled between checking rx_count and
+         * blocking, so the tasklet cannot notify us in between.
+         */
+        DISABLE_INTR(flag);
+        while (rx_count != rx_wanted)
+            if (receive_from_timeout(com_rx_port, &recv_proc,
+                                     COM_READ_TIMEOUT) == NULL)
+                break;
+        /* 
+         * If the line went quiet, give up so the caller can recover,
+         * and pad the answer with zeros.
+         */
+        while (rx_count != rx_wanted)
+            rx_buffer[rx_count++] = 0;
+        /* The buffer belongs to the caller again; drop late bytes */
+        rx_buffer = NULL;
+        rx_count = 0;
+        rx_wanted = 0;
+        ENABLE_INTR(flag);
+
+        // reply to the user process and wait for the next one
+        msg = (COM_Message *) reply_and_receive(sender_proc, &sender_proc);
     }
     become_zombie();
 }
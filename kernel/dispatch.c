@@ -1,22 +1,169 @@
 
 #include <kernel.h>
 
-#include "disptable.c"
-
 
+#ifndef SMP
 PROCESS         active_proc;
+#endif
 
 
 /* 
- * Ready queues for all eight priorities.
+ * Ready queues for all MAX_READY_QUEUES priorities.
  */
 PCB            *ready_queue[MAX_READY_QUEUES];
 
 /* 
- * The bits in ready_procs tell which ready queue is empty.
- * The MSB of ready_procs corresponds to ready_queue[7].
+ * The bits in ready_procs tell which ready queues are non-empty.
+ * Bit prio of ready_procs corresponds to ready_queue[prio].
+ */
+PRIO_BITMAP     ready_procs;
+
+/* 
+ * Number of timer ticks a process may run before it is preempted in
+ * favor of the next process on the same priority level.
+ */
+unsigned short  time_slice[MAX_READY_QUEUES];
+
+/* 
+ * If set, the next resign() switches directly to this process
+ * without consulting the dispatcher.
+ */
+PROCESS         handoff_proc;
+
+/* 
+ * Sum of the densities (budget / min(deadline, period), per mille) of
+ * all admitted real-time processes, and the number of jobs that
+ * completed after their deadline.
+ */
+#define RT_MAX_LOAD     1000
+
+int             rt_load;
+unsigned        missed_deadlines;
+
+
+
+/* 
+ * find_last_set
+ *----------------------------------------------------------------------------
+ * Returns the index of the most significant bit that is set in word.
+ * word must not be 0.
+ */
+
+int find_last_set(unsigned word)
+{
+    int             bit;
+
+    asm("bsrl %1,%0": "=r"(bit):"rm"(word));
+    return bit;
+}
+
+
+
+/* 
+ * find_first_set
+ *----------------------------------------------------------------------------
+ * Returns the index of the least significant bit that is set in word.
+ * word must not be 0.
+ */
+
+int find_first_set(unsigned word)
+{
+    int             bit;
+
+    asm("bsfl %1,%0": "=r"(bit):"rm"(word));
+    return bit;
+}
+
+
+
+/* 
+ * Priority bitmap
+ *----------------------------------------------------------------------------
+ * Constant time set, clear and find-highest on MAX_READY_QUEUES bits.
+ */
+
+void clear_prio_bitmap(PRIO_BITMAP * map)
+{
+    int             i;
+
+    map->groups = 0;
+    for (i = 0; i < PRIO_BITMAP_WORDS; i++)
+        map->bits[i] = 0;
+}
+
+
+void set_prio_bit(PRIO_BITMAP * map, int prio)
+{
+    map->bits[prio >> 5] |= 1u << (prio & 31);
+    map->groups |= 1u << (prio >> 5);
+}
+
+
+void clear_prio_bit(PRIO_BITMAP * map, int prio)
+{
+    map->bits[prio >> 5] &= ~(1u << (prio & 31));
+    if (map->bits[prio >> 5] == 0)
+        map->groups &= ~(1u << (prio >> 5));
+}
+
+
+int highest_prio_bit(PRIO_BITMAP * map)
+{
+    int             group;
+
+    if (map->groups == 0)
+        return -1;
+    group = find_last_set(map->groups);
+    return (group << 5) + find_last_set(map->bits[group]);
+}
+
+
+/* 
+ * Returns the lowest priority above prio whose bit is set, or -1.
  */
-unsigned        ready_procs;
+int next_prio_bit_above(PRIO_BITMAP * map, int prio)
+{
+    int             group = prio >> 5;
+    unsigned        word;
+
+    /* A shift by 32 is undefined, hence the special cases */
+    if ((prio & 31) != 31) {
+        word = map->bits[group] & (~0u << ((prio & 31) + 1));
+        if (word != 0)
+            return (group << 5) + find_first_set(word);
+    }
+    if (group == 31)
+        return -1;
+    word = map->groups & (~0u << (group + 1));
+    if (word == 0)
+        return -1;
+    group = find_first_set(word);
+    return (group << 5) + find_first_set(map->bits[group]);
+}
+
+
+
+/* 
+ * is_only_ready
+ *----------------------------------------------------------------------------
+ * Returns TRUE if proc is the only process on the ready queue.
+ */
+
+BOOL is_only_ready(PROCESS proc)
+{
+    return highest_prio_bit(&ready_procs) == proc->priority &&
+        ready_queue[proc->priority] == proc && proc->next == proc;
+}
+
+
+
+/* 
+ * Returns TRUE if the deadline of proc is earlier than that of other.
+ */
+BOOL deadline_before(PROCESS proc, PROCESS other)
+{
+    return (int) (proc->deadline - other->deadline) < 0;
+}
 
 
 
@@ -40,7 +187,29 @@ void add_ready_queue(PROCESS proc)
         ready_queue[prio] = proc;
         proc->next = proc;
         proc->prev = proc;
-        ready_procs |= 1 << prio;
+        set_prio_bit(&ready_procs, prio);
+    } else if (prio == RT_PRIORITY) {
+        /* 
+         * Keep the real-time queue sorted by deadline. A process that
+         * merely inherited RT_PRIORITY serves a real-time client and
+         * goes to the front.
+         */
+        PROCESS         pos = ready_queue[prio];
+        BOOL            at_head = TRUE;
+
+        if (proc->rt_period != 0)
+            while (pos->rt_period == 0 || !deadline_before(proc, pos)) {
+                pos = pos->next;
+                at_head = FALSE;
+                if (pos == ready_queue[prio])
+                    break;
+            }
+        proc->next = pos;
+        proc->prev = pos->prev;
+        pos->prev->next = proc;
+        pos->prev = proc;
+        if (at_head)
+            ready_queue[prio] = proc;
     } else {
         /* Some other processes on this priority level */
         proc->next = ready_queue[prio];
@@ -49,6 +218,7 @@ void add_ready_queue(PROCESS proc)
         ready_queue[prio]->prev = proc;
     }
     proc->state = STATE_READY;
+    proc->quantum = time_slice[prio];
     ENABLE_INTR(flag);
 }
 
@@ -72,9 +242,10 @@ void remove_ready_queue(PROCESS proc)
     if (proc->next == proc) {
         /* No further processes on this priority level */
         ready_queue[prio] = NULL;
-        ready_procs &= ~(1 << prio);
+        clear_prio_bit(&ready_procs, prio);
     } else {
-        ready_queue[prio] = proc->next;
+        if (prio != RT_PRIORITY || ready_queue[prio] == proc)
+            ready_queue[prio] = proc->next;
         proc->next->prev = proc->prev;
         proc->prev->next = proc->next;
     }
@@ -83,17 +254,178 @@ void remove_ready_queue(PROCESS proc)
 
 
 
+/* 
+ * replace_ready_queue
+ *----------------------------------------------------------------------------
+ * new_proc takes over the slot of old_proc on the ready queue. If both
+ * processes have the same priority this is done in constant time without
+ * touching the priority bitmap. The RT_PRIORITY queue is sorted by
+ * deadline, so there new_proc is inserted at its own place.
+ */
+
+void replace_ready_queue(PROCESS old_proc, PROCESS new_proc)
+{
+    int             prio;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    assert(old_proc->magic == MAGIC_PCB);
+    assert(new_proc->magic == MAGIC_PCB);
+    prio = old_proc->priority;
+    if (new_proc->priority != prio || prio == RT_PRIORITY) {
+        remove_ready_queue(old_proc);
+        add_ready_queue(new_proc);
+        ENABLE_INTR(flag);
+        return;
+    }
+    if (old_proc->next == old_proc) {
+        new_proc->next = new_proc;
+        new_proc->prev = new_proc;
+    } else {
+        new_proc->next = old_proc->next;
+        new_proc->prev = old_proc->prev;
+        old_proc->prev->next = new_proc;
+        old_proc->next->prev = new_proc;
+    }
+    if (ready_queue[prio] == old_proc)
+        ready_queue[prio] = new_proc;
+    new_proc->state = STATE_READY;
+    new_proc->quantum = time_slice[prio];
+    ENABLE_INTR(flag);
+}
+
+
+
+/* 
+ * change_priority
+ *----------------------------------------------------------------------------
+ * Sets the priority of proc to prio. If proc is on the ready queue it is
+ * moved to the ready queue of its new priority.
+ */
+
+void change_priority(PROCESS proc, int prio)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    assert(proc->magic == MAGIC_PCB);
+    assert(prio >= 0 && prio < MAX_READY_QUEUES);
+    if (proc->state == STATE_READY) {
+        remove_ready_queue(proc);
+        proc->priority = prio;
+        add_ready_queue(proc);
+    } else
+        proc->priority = prio;
+    ENABLE_INTR(flag);
+}
+
+
+
+/* 
+ * set_realtime
+ *----------------------------------------------------------------------------
+ * Turns the calling process into a real-time process that is released
+ * every period timer ticks, needs at most budget ticks of CPU time per
+ * release and has to finish within deadline ticks after the release.
+ * The first release is now. Returns FALSE, leaving the process
+ * unchanged, if admitting it would overload the CPU. The admission test
+ * is only exact as long as real-time processes do not depend on
+ * servers of lower priority.
+ */
+
+BOOL set_realtime(int period, int deadline, int budget)
+{
+    int             window;
+    int             density;
+    volatile int    flag;
+
+    assert(period > 0 && deadline > 0 && budget > 0);
+    window = deadline < period ? deadline : period;
+    density = (budget * RT_MAX_LOAD + window - 1) / window;
+    DISABLE_INTR(flag);
+    assert(active_proc->rt_period == 0);
+    if (rt_load + density > RT_MAX_LOAD) {
+        ENABLE_INTR(flag);
+        return FALSE;
+    }
+    rt_load += density;
+    active_proc->rt_period = period;
+    active_proc->rt_deadline = deadline;
+    active_proc->rt_density = density;
+    active_proc->rt_release = get_ticks();
+    active_proc->deadline = active_proc->rt_release + deadline;
+    active_proc->base_priority = RT_PRIORITY;
+    change_priority(active_proc, RT_PRIORITY);
+    resign();
+    ENABLE_INTR(flag);
+    return TRUE;
+}
+
+
+
+/* 
+ * wait_for_next_period
+ *----------------------------------------------------------------------------
+ * Called by a real-time process when it is done with the current
+ * release. Counts a missed deadline if it finished late, then blocks
+ * until the next release.
+ */
+
+void wait_for_next_period()
+{
+    unsigned        now;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    assert(active_proc->rt_period != 0);
+    now = get_ticks();
+    if ((int) (now - active_proc->deadline) > 0) {
+        active_proc->missed_deadlines++;
+        missed_deadlines++;
+    }
+    active_proc->rt_release += active_proc->rt_period;
+    active_proc->deadline =
+        active_proc->rt_release + active_proc->rt_deadline;
+    if ((int) (active_proc->rt_release - now) > 0)
+        sleep(active_proc->rt_release - now);
+    else {
+        /* Running late: the next release is due already */
+        remove_ready_queue(active_proc);
+        add_ready_queue(active_proc);
+        resign();
+    }
+    ENABLE_INTR(flag);
+}
+
+
+
 /* 
  * become_zombie
  *----------------------------------------------------------------------------
  * Turns the calling process into a zombie. It will be removed from the ready
- * queue and marked as being in STATE_ZOMBIE.
+ * queue and marked as being in STATE_ZOMBIE. Its ports and mutexes are
+ * released right away; its PCB and stack are reclaimed by reap_zombies()
+ * once another process runs.
  */
 
 void become_zombie()
 {
+    PROCESS         parent = active_proc->parent;
+    volatile int    flag;
+
+    release_ports(active_proc);
+    DISABLE_INTR(flag);
+    if (active_proc->rt_period != 0)
+        rt_load -= active_proc->rt_density;
+    if (parent != NULL && parent->used
+        && parent->state == STATE_WAIT_BLOCKED
+        && parent->param_proc == active_proc)
+        /* Our parent is joining us */
+        add_ready_queue(parent);
+    abandon_mutexes(active_proc);
     active_proc->state = STATE_ZOMBIE;
     remove_ready_queue(active_proc);
+    add_zombie(active_proc);
     resign();
     // Never reached
     while (1);
@@ -102,30 +434,78 @@ void become_zombie()
 
 
 /* 
- * dispatcher
+ * select_process
  *----------------------------------------------------------------------------
  * Determines a new process to be dispatched. The process
  * with the highest priority is taken. Within one priority
- * level round robin is used.
+ * level round robin is used, except for RT_PRIORITY where
+ * the process with the earliest deadline is taken.
+ * Interrupts must be disabled.
  */
 
-PROCESS dispatcher()
+#ifdef SMP
+/* 
+ * With SMP all CPUs share the ready queues. Processes running on another
+ * CPU are skipped; if nothing else is eligible the CPU runs its idle
+ * process, which is not on the ready queue.
+ */
+static PROCESS select_process()
 {
-    PROCESS         new_proc;
-    unsigned        i;
-    volatile int    flag;
+    CPU            *cpu = this_cpu();
+    PROCESS         start;
+    PROCESS         p;
+    int             i;
 
-    DISABLE_INTR(flag);
+    for (i = highest_prio_bit(&ready_procs); i >= 0; i--) {
+        if (ready_queue[i] == NULL)
+            continue;
+        start = ready_queue[i];
+        if (i != RT_PRIORITY && i == active_proc->priority &&
+            active_proc->state == STATE_READY && active_proc != cpu->idle)
+            /* Round robin within the same priority level */
+            start = active_proc->next;
+        p = start;
+        do {
+            if (p->cpu == NO_CPU || p == active_proc)
+                return p;
+            p = p->next;
+        } while (p != start);
+    }
+    return cpu->idle;
+}
+#else
+static PROCESS select_process()
+{
+    int             i;
 
     /* Find queue with highest priority that is not empty */
-    i = table[ready_procs];
+    i = highest_prio_bit(&ready_procs);
     assert(i != -1);
+    if (i == RT_PRIORITY)
+        return ready_queue[i];
     if (i == active_proc->priority)
         /* Round robin within the same priority level */
-        new_proc = active_proc->next;
-    else
-        /* Dispatch a process at a different priority level */
-        new_proc = ready_queue[i];
+        return active_proc->next;
+    /* Dispatch a process at a different priority level */
+    return ready_queue[i];
+}
+#endif
+
+
+
+/* 
+ * dispatcher
+ *----------------------------------------------------------------------------
+ * Like select_process(), but may be called with interrupts enabled.
+ */
+
+PROCESS dispatcher()
+{
+    PROCESS         new_proc;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    new_proc = select_process();
     ENABLE_INTR(flag);
     return new_proc;
 }
@@ -133,57 +513,199 @@ PROCESS dispatcher()
 
 
 /* 
- * resign
+ * check_preemption
  *----------------------------------------------------------------------------
- * The current process gives up the CPU voluntarily. The
- * next running process is determined via dispatcher().
- * The stack of the calling process is setup such that it
- * looks like an interrupt.
+ * Returns the process that should run after processes were made ready
+ * behind the scheduler's back, e.g. by a tasklet. Unlike dispatcher(),
+ * active_proc keeps the CPU unless a more important process is ready.
  */
-void resign()
+
+PROCESS check_preemption()
 {
-    /* 
-     *  PUSHFL
-     *  CLI
-     *  POPL    %EAX            ; EAX = Flags
-     *  XCHGL   (%ESP),%EAX     ; Swap return adr with flags
-     *  PUSH    %CS             ; Push CS
-     *  PUSHL   %EAX            ; Push return address
-     *  PUSHL   %EAX            ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     */
-    asm("pushfl;cli;popl %eax;xchgl (%esp),%eax");
-    asm("push %cs;pushl %eax");
-    asm("pushl %eax;pushl %ecx;pushl %edx");
-    asm("pushl %ebx;pushl %ebp;pushl %esi;pushl %edi");
+#ifdef SMP
+    PROCESS         proc = select_process();
+
+    if (proc->priority > active_proc->priority
+        || proc->priority == RT_PRIORITY
+        || active_proc == this_cpu()->idle)
+        return proc;
+    return active_proc;
+#else
+    int             i = highest_prio_bit(&ready_procs);
+
+    if (i > active_proc->priority || i == RT_PRIORITY)
+        return ready_queue[i];
+    return active_proc;
+#endif
+}
+
+
+
+/* 
+ * set_time_slice
+ *----------------------------------------------------------------------------
+ * Sets the quantum (in timer ticks) of all processes at priority prio.
+ */
+
+void set_time_slice(int prio, int ticks)
+{
+    assert(prio >= 0 && prio < MAX_READY_QUEUES);
+    assert(ticks > 0);
+    time_slice[prio] = ticks;
+}
 
-    /* Save the context pointer SS:ESP to the PCB */
-  asm("movl %%esp,%0": "=r"(active_proc->esp):);
 
-    /* Dispatch new process */
-    active_proc = dispatcher();
 
-    /* Restore context pointer SS:ESP */
-  asm("movl %0,%%esp": :"r"(active_proc->esp));
+/* 
+ * account_tick
+ *----------------------------------------------------------------------------
+ * Charges one timer tick to active_proc. Returns TRUE if the dispatcher
+ * needs to run, i.e. if a process with a higher priority is ready or if
+ * active_proc has used up its quantum. Real-time processes have no
+ * quantum; they are only preempted by an earlier deadline. Must be
+ * called with interrupts disabled.
+ */
 
+BOOL account_tick()
+{
+    if (active_proc->state != STATE_READY)
+        return TRUE;
+    if (highest_prio_bit(&ready_procs) > active_proc->priority)
+        return TRUE;
+    if (active_proc->priority == RT_PRIORITY)
+        return ready_queue[RT_PRIORITY] != active_proc;
+    if (active_proc->quantum > 1) {
+        active_proc->quantum--;
+        return FALSE;
+    }
+    /* Quantum expired. Refill it for the next time this process runs */
+    active_proc->quantum = time_slice[active_proc->priority];
+    return TRUE;
+}
+
+
+
+/* 
+ * next_process
+ *----------------------------------------------------------------------------
+ * Returns the process resign() should switch to: the handoff target if
+ * one was set via resign_to(), otherwise the result of select_process().
+ */
+
+PROCESS next_process()
+{
+    PROCESS         proc = handoff_proc;
+
+    if (proc == NULL)
+        return select_process();
+    handoff_proc = NULL;
+    return proc;
+}
+
+
+
+/* 
+ * resign_to
+ *----------------------------------------------------------------------------
+ * Like resign(), but switches directly to proc. The caller guarantees
+ * that proc is ready and that running it is consistent with the
+ * priorities of all other ready processes.
+ */
+
+void resign_to(PROCESS proc)
+{
+    assert(proc->magic == MAGIC_PCB && proc->state == STATE_READY);
+    handoff_proc = proc;
+    resign();
+}
+
+
+
+/* 
+ * switch_to
+ *----------------------------------------------------------------------------
+ * Suspends prev, saving only its callee-saved registers, and resumes
+ * next. next becomes active_proc. Interrupts must be disabled.
+ */
+
+void switch_to(PROCESS prev, PROCESS next)
+{
+    active_proc = next;
+    prev->context = CONTEXT_SWITCH;
+#ifdef SMP
     /* 
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET            ; Return to new process
+     * The kernel lock is held until finish_switch() runs on the stack
+     * of next, so no other CPU can pick up prev before that.
      */
-    asm("popl %edi;popl %esi;popl %ebp;popl %ebx");
-    asm("popl %edx;popl %ecx;popl %eax");
-    asm("iret");
+    prev->lock_depth = this_cpu()->lock_depth;
+    prev->cpu = NO_CPU;
+    switch_stack(&prev->esp, next->esp, next->context | CONTEXT_FINISH);
+#else
+    switch_stack(&prev->esp, next->esp, next->context);
+#endif
+}
+
+
+
+/* 
+ * resume_active_proc
+ *----------------------------------------------------------------------------
+ * Called at the end of an ISR after the interrupted context has been
+ * saved in active_proc->esp and the PIC has been acknowledged. Continues
+ * active_proc, which the ISR may have changed. Never returns.
+ */
+
+void resume_active_proc()
+{
+    MEM_ADDR        discard;
+#ifdef SMP
+    CPU            *cpu = this_cpu();
+
+    if (cpu->interrupted != NULL && cpu->interrupted != active_proc)
+        cpu->interrupted->cpu = NO_CPU;
+    cpu->interrupted = NULL;
+    switch_stack(&discard, active_proc->esp,
+                 active_proc->context | CONTEXT_FINISH);
+#else
+    switch_stack(&discard, active_proc->esp, active_proc->context);
+#endif
+}
+
+
+
+/* 
+ * schedule
+ *----------------------------------------------------------------------------
+ * Voluntary context switch to the process chosen by next_process().
+ * Unlike an interrupt, this only needs to preserve the registers the
+ * C calling convention does not clobber.
+ */
+
+void schedule()
+{
+    PROCESS         prev = active_proc;
+    PROCESS         next;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    next = next_process();
+    if (next != prev)
+        switch_to(prev, next);
+    ENABLE_INTR(flag);
+}
+
+
+
+/* 
+ * resign
+ *----------------------------------------------------------------------------
+ * The current process gives up the CPU voluntarily. The
+ * next running process is determined via next_process().
+ */
+
+void resign()
+{
+    schedule();
 }
 
 
@@ -198,10 +720,15 @@ void init_dispatcher()
 {
     int             i;
 
-    for (i = 0; i < MAX_READY_QUEUES; i++)
+    for (i = 0; i < MAX_READY_QUEUES; i++) {
         ready_queue[i] = NULL;
+        time_slice[i] = DEFAULT_TIME_SLICE;
+    }
 
-    ready_procs = 0;
+    clear_prio_bitmap(&ready_procs);
+    handoff_proc = NULL;
+    rt_load = 0;
+    missed_deadlines = 0;
 
     /* Setup first process */
     add_ready_queue(active_proc);
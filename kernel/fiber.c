@@ -0,0 +1,280 @@
+#include <kernel.h>
+
+
+/*
+ * Fibers are stackful coroutines that are multiplexed cooperatively on
+ * top of a single TOS process (the host). A fiber only gives up the CPU
+ * to its siblings in fiber_yield(), fiber_sleep(), fiber_message() or
+ * when it terminates. Preemption of the host by the TOS scheduler is
+ * transparent to the fibers.
+ */
+
+#define FIBER_MAGIC      0x46494252
+#define FIBER_STACK_MAGIC 0xF1BEF1BE
+
+
+/*
+ * check_stack
+ *----------------------------------------------------------------------------
+ * The lowest word of every fiber stack holds a canary. Since fiber stacks
+ * are small, an overflow is caught at the next context switch rather
+ * than silently corrupting the heap.
+ */
+
+static void check_stack(FIBER fiber)
+{
+    assert(fiber->magic == FIBER_MAGIC);
+    if (*((unsigned *) fiber->stack) != FIBER_STACK_MAGIC)
+        panic("fiber stack overflow");
+}
+
+
+/*
+ * add_ready_fiber
+ *----------------------------------------------------------------------------
+ * Appends the fiber to the end of the host's run queue.
+ */
+
+static void add_ready_fiber(FIBER fiber)
+{
+    FIBER_HOST     *host = fiber->host;
+
+    fiber->state = FIBER_READY;
+    fiber->next = NULL;
+    if (host->ready_tail == NULL)
+        host->ready_head = fiber;
+    else
+        host->ready_tail->next = fiber;
+    host->ready_tail = fiber;
+}
+
+
+/*
+ * wake_sleeping_fibers
+ *----------------------------------------------------------------------------
+ * Moves all fibers whose wake-up tick has passed to the run queue. The
+ * sleeping list is sorted by wake-up tick.
+ */
+
+static void wake_sleeping_fibers(FIBER_HOST * host)
+{
+    unsigned        now = get_ticks();
+    FIBER           fiber;
+
+    while (host->sleeping != NULL &&
+           (int) (host->sleeping->wake_tick - now) <= 0) {
+        fiber = host->sleeping;
+        host->sleeping = fiber->next;
+        add_ready_fiber(fiber);
+    }
+}
+
+
+/*
+ * switch_to_host
+ *----------------------------------------------------------------------------
+ * Gives the CPU back to the fiber scheduler of the host.
+ */
+
+static void switch_to_host(FIBER self)
+{
+    check_stack(self);
+    fiber_switch(&self->esp, self->host->esp);
+}
+
+
+/*
+ * fiber_start
+ *----------------------------------------------------------------------------
+ * First function executed on the stack of a new fiber.
+ */
+
+static void fiber_start(FIBER self)
+{
+    self->entry(self, self->param);
+    fiber_exit(self);
+}
+
+
+/*
+ * init_fiber_host
+ *----------------------------------------------------------------------------
+ * Initializes an empty fiber scheduler. Usually lives on the stack of
+ * the host process.
+ */
+
+void init_fiber_host(FIBER_HOST * host)
+{
+    host->ready_head = NULL;
+    host->ready_tail = NULL;
+    host->sleeping = NULL;
+    host->esp = 0;
+    host->num_fibers = 0;
+}
+
+
+/*
+ * create_fiber
+ *----------------------------------------------------------------------------
+ * Creates a new fiber with its own stack of stack_size bytes. The fiber
+ * runs entry(self, param) once the host calls run_fibers(). Returns NULL
+ * if the heap is exhausted.
+ */
+
+FIBER create_fiber(FIBER_HOST * host, void (*entry) (FIBER, PARAM),
+                   PARAM param, int stack_size)
+{
+    FIBER           fiber;
+    MEM_ADDR        esp;
+
+    if (stack_size < MIN_FIBER_STACK_SIZE)
+        stack_size = MIN_FIBER_STACK_SIZE;
+    stack_size &= ~3;
+
+    fiber = (FIBER) malloc(sizeof(struct _FIBER));
+    if (fiber == NULL)
+        return NULL;
+    fiber->stack = (MEM_ADDR) malloc(stack_size);
+    if (fiber->stack == 0) {
+        free(fiber);
+        return NULL;
+    }
+    fiber->magic = FIBER_MAGIC;
+    fiber->stack_size = stack_size;
+    fiber->entry = entry;
+    fiber->param = param;
+    fiber->host = host;
+    *((unsigned *) fiber->stack) = FIBER_STACK_MAGIC;
+
+    /* Initial frame as expected by fiber_switch() */
+    esp = fiber->stack + stack_size;
+    esp -= 4;
+    poke_l(esp, (LONG) fiber);  /* Argument of fiber_start */
+    esp -= 4;
+    poke_l(esp, 0);             /* Dummy return address */
+    esp -= 4;
+    poke_l(esp, (LONG) fiber_start);
+    esp -= 4;
+    poke_l(esp, 0);             /* EBP */
+    esp -= 4;
+    poke_l(esp, 0);             /* EBX */
+    esp -= 4;
+    poke_l(esp, 0);             /* ESI */
+    esp -= 4;
+    poke_l(esp, 0);             /* EDI */
+    fiber->esp = esp;
+
+    host->num_fibers++;
+    add_ready_fiber(fiber);
+    return fiber;
+}
+
+
+/*
+ * fiber_yield
+ *----------------------------------------------------------------------------
+ * Lets the other ready fibers of the same host run.
+ */
+
+void fiber_yield(FIBER self)
+{
+    add_ready_fiber(self);
+    switch_to_host(self);
+}
+
+
+/*
+ * fiber_sleep
+ *----------------------------------------------------------------------------
+ * Suspends the fiber for num_of_ticks timer ticks. The other fibers of
+ * the host keep running.
+ */
+
+void fiber_sleep(FIBER self, int num_of_ticks)
+{
+    FIBER_HOST     *host = self->host;
+    FIBER          *link;
+
+    if (num_of_ticks <= 0) {
+        fiber_yield(self);
+        return;
+    }
+    self->state = FIBER_SLEEPING;
+    self->wake_tick = get_ticks() + num_of_ticks;
+    link = &host->sleeping;
+    while (*link != NULL &&
+           (int) ((*link)->wake_tick - self->wake_tick) <= 0)
+        link = &(*link)->next;
+    self->next = *link;
+    *link = self;
+    switch_to_host(self);
+}
+
+
+/*
+ * fiber_message
+ *----------------------------------------------------------------------------
+ * Fiber-aware version of message(). Instead of blocking the host while
+ * the receiver is busy, the fiber yields to its siblings and retries.
+ */
+
+void fiber_message(FIBER self, PORT dest_port, void *data)
+{
+    while (!try_message(dest_port, data)) {
+        if (self->host->ready_head == NULL)
+            fiber_sleep(self, 1);
+        else
+            fiber_yield(self);
+    }
+}
+
+
+/*
+ * fiber_exit
+ *----------------------------------------------------------------------------
+ * Terminates the calling fiber. Its stack is released by the host.
+ */
+
+void fiber_exit(FIBER self)
+{
+    self->state = FIBER_DONE;
+    switch_to_host(self);
+    panic("fiber_exit(): resumed a terminated fiber");
+}
+
+
+/*
+ * run_fibers
+ *----------------------------------------------------------------------------
+ * The fiber scheduler. Runs the ready fibers in FIFO order; when all
+ * fibers are asleep the host process sleeps until the earliest wake-up.
+ * Returns once the last fiber has terminated.
+ */
+
+void run_fibers(FIBER_HOST * host)
+{
+    FIBER           fiber;
+    int             ticks;
+
+    while (host->num_fibers > 0) {
+        wake_sleeping_fibers(host);
+        fiber = host->ready_head;
+        if (fiber == NULL) {
+            ticks = (int) (host->sleeping->wake_tick - get_ticks());
+            if (ticks > 0)
+                sleep(ticks);
+            continue;
+        }
+        host->ready_head = fiber->next;
+        if (host->ready_head == NULL)
+            host->ready_tail = NULL;
+        fiber->state = FIBER_RUNNING;
+        fiber_switch(&host->esp, fiber->esp);
+        if (fiber->state == FIBER_DONE) {
+            host->num_fibers--;
+            fiber->magic = 0;
+            free((void *) fiber->stack);
+            free(fiber);
+        }
+    }
+}
@@ -41,8 +41,9 @@ void fatal_exception(int n)
 {
     WINDOW          error_window = { 0, 24, 80, 1, 0, 0, ' ' };
 
-    wprintf(&error_window, "Fatal exception %d (%s)", n,
-            active_proc->name);
+    asm("cli");
+    panic_printf(&error_window, "Fatal exception %d (%s)", n,
+                 active_proc->name);
     while (42);
 }
 
@@ -162,191 +163,374 @@ void spurious_int()
 
 
 /* 
- * Timer ISR
+ * Optional in-kernel handler and port for every PIC line. IRQs without
+ * a handler are delivered to the port, or else to the process waiting
+ * in wait_for_interrupt().
+ */
+static void     (*irq_handler[NUM_IRQS]) (int);
+static PORT     irq_port[NUM_IRQS];
+
+/* 
+ * IRQs that arrive while the waiting process is busy are latched in
+ * irq_pending. Latching starts with the first wait_for_interrupt() on
+ * a line, before that nobody is interested in the IRQ.
  */
-void isr_timer()
+static int      irq_pending[NUM_IRQS];
+static BOOL     irq_armed[NUM_IRQS];
+
+IRQ_STATS       irq_stats[NUM_IRQS];
+
+
+/* 
+ * Latches an occurrence of intr_no. Returns the process that has to be
+ * made ready for it, if any.
+ */
+PROCESS latch_irq(int intr_no)
 {
-    /* 
-     *  PUSHL   %EAX            ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     */
-    asm("pushl %eax;pushl %ecx;pushl %edx");
-    asm("pushl %ebx;pushl %ebp;pushl %esi;pushl %edi");
-    /* Save the context pointer ESP to the PCB */
-    asm("movl %%esp,%0": "=m"(active_proc->esp):);
-    /* Call the actual implementation of the ISR */
-    asm("call isr_timer_impl");
-    /* Restore context pointer ESP */
-    asm("movl %0,%%esp": :"m"(active_proc->esp));
-    /* 
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET            ; Return to new process
-     */
-    asm("movb $0x20,%al;outb %al,$0x20");
-    asm("popl %edi;popl %esi;popl %ebp;popl %ebx");
-    asm("popl %edx;popl %ecx;popl %eax");
-    asm("iret");
+    int             line = intr_no - IRQ_BASE;
+    PROCESS         p;
+
+    if (!irq_armed[line])
+        return NULL;
+    irq_pending[line]++;
+    p = interrupt_table[intr_no];
+    if (p == NULL || p->state != STATE_INTR_BLOCKED)
+        return NULL;
+    return p;
 }
 
-void isr_timer_impl()
+
+/* 
+ * Timer ISR
+ */
+void isr_timer(int intr_no)
 {
     /* 
      * If a process is waiting for this interrupt, then put it back
      * to the ready queue.
      */
-    PROCESS         p = interrupt_table[TIMER_IRQ];
-    if (p && p->state == STATE_INTR_BLOCKED) {
+    PROCESS         p = latch_irq(intr_no);
+    if (p != NULL) {
         /* Add event handler to ready queue */
         add_ready_queue(p);
     }
 
-    /* Dispatch new process */
-    active_proc = dispatcher();
+    /* Advance the clock and wake up processes whose timeout expired */
+    if (!end_tickless()) {
+        update_clock(1);
+        check_timeouts(1);
+    }
+
+    /* 
+     * Only dispatch a new process if the quantum of active_proc expired
+     * or a process with a higher priority became ready.
+     */
+    if (account_tick())
+        active_proc = dispatcher();
 }
 
 
+/* 
+ * Default handling of an IRQ: the registered port gets a message with
+ * the interrupt number as data, otherwise the IRQ is latched for the
+ * process using wait_for_interrupt().
+ */
+void deliver_irq(int intr_no)
+{
+    int             line = intr_no - IRQ_BASE;
+    PROCESS         p;
+    PORT            port = irq_port[line];
+
+    if (port != NULL) {
+        if (!post_message(port, (void *) intr_no)) {
+            irq_stats[line].lost++;
+            return;
+        }
+        irq_stats[line].delivered++;
+    } else {
+        if (!irq_armed[line]) {
+            irq_stats[line].lost++;
+            return;
+        }
+        if ((p = latch_irq(intr_no)) == NULL)
+            return;
+        add_ready_queue(p);
+    }
+    active_proc = dispatcher();
+}
+
 
 /* 
- * COM1 ISR
+ * Returns TRUE if the PIC raised irq (7 or 15) without a device
+ * asserting it. The in-service register tells.
  */
-void isr_com1()
+BOOL is_spurious_irq(int irq)
 {
-    /* 
-     *  PUSHL   %EAX            ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     */
-    asm("pushl %eax;pushl %ecx;pushl %edx");
-    asm("pushl %ebx;pushl %ebp;pushl %esi;pushl %edi");
-    /* Save the context pointer ESP to the PCB */
-    asm("movl %%esp,%0": "=m"(active_proc->esp):);
-    /* Call the actual implementation of the ISR */
-    asm("call isr_com1_impl");
-    /* Restore context pointer ESP */
-    asm("movl %0,%%esp": :"m"(active_proc->esp));
-    /* 
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET            ; Return to new process
-     */
-    asm("movb $0x20,%al;outb %al,$0x20");
-    asm("popl %edi;popl %esi;popl %ebp;popl %ebx");
-    asm("popl %edx;popl %ecx;popl %eax");
-    asm("iret");
+    if (apic_active)
+        return FALSE;
+    if (irq == 7) {
+        outportb(0x20, 0x0b);
+        return (inportb(0x20) & 0x80) == 0;
+    }
+    if (irq == 15) {
+        outportb(0xA0, 0x0b);
+        return (inportb(0xA0) & 0x80) == 0;
+    }
+    return FALSE;
 }
 
-void isr_com1_impl()
+
+/* 
+ * Acknowledges irq. Lines of the slave PIC need an EOI on both
+ * controllers since the slave is cascaded through IRQ 2 of the master.
+ * With the APIC, a single EOI to the local APIC suffices.
+ */
+void acknowledge_irq(int irq)
 {
-    PROCESS         p;
-    if ((p = interrupt_table[COM1_IRQ]) == NULL)
-        panic("service_intr_0x64: Spurious interrupt");
+    if (apic_active) {
+        apic_eoi();
+        return;
+    }
+    if (irq >= 8)
+        outportb(0xA0, 0x20);
+    outportb(0x20, 0x20);
+}
 
-    if (p->state != STATE_INTR_BLOCKED)
-        panic("service_intr_0x64: No process waiting");
 
-    /* Add event handler to ready queue */
-    add_ready_queue(p);
+/* 
+ * Tasklets scheduled by interrupt handlers. They run once the outermost
+ * IRQ has been acknowledged, with interrupts enabled, on the stack of
+ * the interrupted process.
+ */
+static TASKLET *tasklet_head;
+static TASKLET *tasklet_tail;
 
-    /* Dispatch new process */
-    active_proc = dispatcher();
+/* Number of IRQs being handled; greater than 1 while a tasklet is
+ * interrupted */
+#ifdef SMP
+#define irq_nesting     (this_cpu()->irq_nesting)
+#else
+static int      irq_nesting;
+#endif
+
+
+void init_tasklet(TASKLET * t, void (*func) (void *), void *data)
+{
+    t->func = func;
+    t->data = data;
+    t->scheduled = FALSE;
+    t->next = NULL;
 }
 
 
 /* 
- * Keyboard ISR
+ * Makes t run at the end of the current (or next) IRQ. Scheduling a
+ * tasklet that is already pending has no effect.
  */
-void isr_keyb()
+void schedule_tasklet(TASKLET * t)
 {
-    /* 
-     *  PUSHL   %EAX            ; Save process' context
-     *  PUSHL   %ECX
-     *  PUSHL   %EDX
-     *  PUSHL   %EBX
-     *  PUSHL   %EBP
-     *  PUSHL   %ESI
-     *  PUSHL   %EDI
-     */
-    asm("pushl %eax;pushl %ecx;pushl %edx");
-    asm("pushl %ebx;pushl %ebp;pushl %esi;pushl %edi");
-    /* Save the context pointer ESP to the PCB */
-    asm("movl %%esp,%0": "=m"(active_proc->esp):);
-    /* Call the actual implementation of the ISR */
-    asm("call isr_keyb_impl");
-    /* Restore context pointer ESP */
-    asm("movl %0,%%esp": :"m"(active_proc->esp));
-    /* 
-     *  MOVB  $0x20,%AL ; Reset interrupt controller
-     *  OUTB  %AL,$0x20
-     *  POPL  %EDI      ; Restore previously saved context
-     *  POPL  %ESI
-     *  POPL  %EBP
-     *  POPL  %EBX
-     *  POPL  %EDX
-     *  POPL  %ECX
-     *  POPL  %EAX
-     *  IRET            ; Return to new process
-     */
-    asm("movb $0x20,%al;outb %al,$0x20");
-    asm("popl %edi;popl %esi;popl %ebp;popl %ebx");
-    asm("popl %edx;popl %ecx;popl %eax");
-    asm("iret");
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (!t->scheduled) {
+        t->scheduled = TRUE;
+        t->next = NULL;
+        if (tasklet_tail == NULL)
+            tasklet_head = t;
+        else
+            tasklet_tail->next = t;
+        tasklet_tail = t;
+    }
+    ENABLE_INTR(flag);
 }
 
-void isr_keyb_impl()
+
+/* 
+ * Runs all pending tasklets. Called with interrupts disabled, which
+ * are enabled while each tasklet runs. Returns TRUE if any ran.
+ */
+BOOL run_tasklets()
 {
-    PROCESS         p = interrupt_table[KEYB_IRQ];
+    TASKLET        *t;
+    BOOL            ran = FALSE;
+
+    while ((t = tasklet_head) != NULL) {
+        tasklet_head = t->next;
+        if (tasklet_head == NULL)
+            tasklet_tail = NULL;
+        t->scheduled = FALSE;
+        asm("sti");
+        t->func(t->data);
+        asm("cli");
+        ran = TRUE;
+    }
+    return ran;
+}
+
 
-    if (p == NULL) {
-        panic("service_intr_0x61: Spurious interrupt");
+/* 
+ * irq_dispatch
+ *----------------------------------------------------------------------------
+ * Common C entry of the IRQ stubs in startup.s. context points to the
+ * registers the stub saved on top of the interrupt frame. Never returns.
+ * The outermost IRQ runs the tasklets and then resumes active_proc,
+ * possibly changed by the handlers. A nested IRQ interrupted a tasklet
+ * and returns to it without switching processes.
+ */
+
+void irq_dispatch(int irq, MEM_ADDR context)
+{
+    MEM_ADDR        discard;
+
+#ifdef SMP
+    lock_kernel();
+#endif
+#ifdef TRACE_INTR_LATENCY
+    trace_intr_irq();
+#endif
+    if (irq_nesting++ == 0) {
+        active_proc->esp = context;
+        active_proc->context = CONTEXT_IRET;
+#ifdef SMP
+        active_proc->lock_depth = 0;
+        this_cpu()->interrupted = active_proc;
+#endif
     }
 
-    if (p->state != STATE_INTR_BLOCKED) {
-        panic("service_intr_0x61: No process waiting");
+    if (is_spurious_irq(irq)) {
+        /* The master did see the cascade line of a spurious slave IRQ */
+        if (irq >= 8)
+            outportb(0x20, 0x20);
+#ifdef SMP
+    } else if (this_cpu()->index != BOOT_CPU) {
+        /* 
+         * Device IRQs go to the boot CPU. The other CPUs only see the
+         * tick of their local APIC timer, which drives preemption.
+         */
+        if (account_tick())
+            active_proc = dispatcher();
+        acknowledge_irq(irq);
+#endif
+    } else {
+        if (IRQ_VECTOR(irq) != TIMER_IRQ)
+            leave_tickless();
+        if (irq_handler[irq] != NULL)
+            irq_handler[irq] (IRQ_VECTOR(irq));
+        else
+            deliver_irq(IRQ_VECTOR(irq));
+        acknowledge_irq(irq);
+        if (irq_nesting == 1 && run_tasklets())
+            active_proc = check_preemption();
     }
 
-    /* Add event handler to ready queue */
-    add_ready_queue(p);
+    if (--irq_nesting == 0)
+        resume_active_proc();
+#ifdef SMP
+    unlock_kernel();
+#endif
+    switch_stack(&discard, context, CONTEXT_IRET);
+}
 
-    active_proc = dispatcher();
+
+/* 
+ * Installs handler as the in-kernel ISR of intr_no. The handler runs with
+ * interrupts disabled and may change active_proc.
+ */
+void register_irq_handler(int intr_no, void (*handler) (int))
+{
+    volatile int    flag;
+
+    assert(intr_no >= IRQ_BASE && intr_no < IRQ_VECTOR(NUM_IRQS));
+    DISABLE_INTR(flag);
+    irq_handler[intr_no - IRQ_BASE] = handler;
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Delivers every occurrence of intr_no as a message to port. A message
+ * that cannot be delivered immediately is dropped.
+ */
+void register_irq_port(int intr_no, PORT port)
+{
+    volatile int    flag;
+
+    assert(intr_no >= IRQ_BASE && intr_no < IRQ_VECTOR(NUM_IRQS));
+    DISABLE_INTR(flag);
+    irq_port[intr_no - IRQ_BASE] = port;
+    ENABLE_INTR(flag);
 }
 
-void wait_for_interrupt(int intr_no)
+
+/* 
+ * Removes any handler or port bound to intr_no.
+ */
+void unregister_irq(int intr_no)
 {
     volatile int    flag;
 
+    assert(intr_no >= IRQ_BASE && intr_no < IRQ_VECTOR(NUM_IRQS));
+    DISABLE_INTR(flag);
+    irq_handler[intr_no - IRQ_BASE] = NULL;
+    irq_port[intr_no - IRQ_BASE] = NULL;
+    irq_armed[intr_no - IRQ_BASE] = FALSE;
+    irq_pending[intr_no - IRQ_BASE] = 0;
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Blocks active_proc until intr_no occurs or, if ticks is not 0, until
+ * ticks timer ticks have passed. Returns the number of occurrences since
+ * the previous call; several IRQs latched meanwhile are coalesced.
+ */
+int wait_for_irq(int intr_no, int ticks)
+{
+    int             line = intr_no - IRQ_BASE;
+    int             count;
+    volatile int    flag;
+
+    assert(line >= 0 && line < NUM_IRQS);
     DISABLE_INTR(flag);
     if (interrupt_table[intr_no] != NULL)
         panic("wait_for_interrupt(): ISR busy");
-    interrupt_table[intr_no] = active_proc;
-    remove_ready_queue(active_proc);
-    active_proc->state = STATE_INTR_BLOCKED;
-    resign();
-    interrupt_table[intr_no] = NULL;
+    irq_armed[line] = TRUE;
+    if (irq_pending[line] == 0) {
+        interrupt_table[intr_no] = active_proc;
+        remove_ready_queue(active_proc);
+        active_proc->state = STATE_INTR_BLOCKED;
+        if (ticks != 0)
+            add_timeout(active_proc, ticks);
+        resign();
+        if (ticks != 0)
+            cancel_timeout(active_proc);
+        interrupt_table[intr_no] = NULL;
+    }
+    count = irq_pending[line];
+    irq_pending[line] = 0;
+    if (count > 0) {
+        irq_stats[line].delivered++;
+        irq_stats[line].coalesced += count - 1;
+    }
     ENABLE_INTR(flag);
+    return count;
+}
+
+
+int wait_for_interrupt(int intr_no)
+{
+    return wait_for_irq(intr_no, 0);
+}
+
+
+/* 
+ * Like wait_for_interrupt(), but gives up after ticks timer ticks.
+ * Returns 0 if the interrupt did not occur in time.
+ */
+int wait_for_interrupt_timeout(int intr_no, int ticks)
+{
+    assert(ticks > 0);
+    return wait_for_irq(intr_no, ticks);
 }
 
 
@@ -410,11 +594,25 @@ void init_interrupts()
     init_idt_entry(14, exception14);
     init_idt_entry(15, exception15);
     init_idt_entry(16, exception16);
-    init_idt_entry(TIMER_IRQ, isr_timer);
-    init_idt_entry(COM1_IRQ, isr_com1);
-    init_idt_entry(KEYB_IRQ, isr_keyb);
+    for (i = 0; i < NUM_IRQS; i++) {
+        init_idt_entry(IRQ_VECTOR(i), irq_stubs[i]);
+        irq_handler[i] = NULL;
+        irq_port[i] = NULL;
+        irq_pending[i] = 0;
+        irq_armed[i] = FALSE;
+        irq_stats[i].delivered = 0;
+        irq_stats[i].coalesced = 0;
+        irq_stats[i].lost = 0;
+    }
+    tasklet_head = NULL;
+    tasklet_tail = NULL;
+    irq_nesting = 0;
+    irq_handler[TIMER_IRQ - IRQ_BASE] = isr_timer;
 
     re_program_interrupt_controller();
+#ifdef USE_APIC
+    init_apic();
+#endif
 
     for (i = 0; i < MAX_INTERRUPTS; i++)
         interrupt_table[i] = NULL;
@@ -6,6 +6,54 @@ PORT_DEF        port[MAX_PORTS];
 
 PORT            next_free_port;
 
+/* 
+ * Slabs of ports allocated from the heap. They are never returned to
+ * the heap; init_ipc() recycles them.
+ */
+typedef struct _PORT_SLAB {
+    struct _PORT_SLAB *next;
+    PORT_DEF        port[PORT_SLAB_SIZE];
+} PORT_SLAB;
+
+PORT_SLAB      *port_slabs = NULL;
+
+
+/* 
+ * Puts the ports of slab on the free list.
+ */
+void free_port_slab(PORT_SLAB * slab)
+{
+    int             i;
+
+    for (i = 0; i < PORT_SLAB_SIZE; i++) {
+        slab->port[i].used = FALSE;
+        slab->port[i].magic = MAGIC_PORT;
+        slab->port[i].next = &slab->port[i + 1];
+    }
+    slab->port[PORT_SLAB_SIZE - 1].next = next_free_port;
+    next_free_port = slab->port;
+}
+
+
+/* 
+ * Allocates a slab of ports from the heap. malloc() may block, so this
+ * must not be called with interrupts disabled.
+ */
+void grow_port_pool()
+{
+    PORT_SLAB      *slab;
+    volatile int    flag;
+
+    slab = (PORT_SLAB *) malloc(sizeof(PORT_SLAB));
+    if (slab == NULL)
+        panic("create_new_port(): PORT full");
+    DISABLE_INTR(flag);
+    slab->next = port_slabs;
+    port_slabs = slab;
+    free_port_slab(slab);
+    ENABLE_INTR(flag);
+}
+
 
 
 PORT create_port()
@@ -21,8 +69,11 @@ PORT create_new_port(PROCESS owner)
 
     DISABLE_INTR(flag);
     assert(owner->magic == MAGIC_PCB);
-    if (next_free_port == NULL)
-        panic("create_new_port(): PORT full");
+    while (next_free_port == NULL) {
+        ENABLE_INTR(flag);
+        grow_port_pool();
+        DISABLE_INTR(flag);
+    }
     p = next_free_port;
     next_free_port = p->next;
     p->used = TRUE;
@@ -30,6 +81,10 @@ PORT create_new_port(PROCESS owner)
     p->owner = owner;
     p->blocked_list_head = NULL;
     p->blocked_list_tail = NULL;
+    p->prio_tail = NULL;
+    p->queue = NULL;
+    p->queue_count = 0;
+    p->pending = FALSE;
     p->open = TRUE;
     if (owner->first_port == NULL)
         p->next = NULL;
@@ -42,6 +97,246 @@ PORT create_new_port(PROCESS owner)
 }
 
 
+/* 
+ * Each process keeps a circular list of its open ports that have
+ * messages pending, so that receive() finds work in constant time.
+ * update_pending_port() must be called whenever the open state or the
+ * pending messages of a port change.
+ */
+void update_pending_port(PORT port)
+{
+    PROCESS         owner = port->owner;
+    BOOL            pending;
+
+    pending = port->open && (port->queue_count != 0
+                             || port->blocked_list_head != NULL);
+    if (pending == port->pending)
+        return;
+    port->pending = pending;
+    if (pending) {
+        if (owner->pending_ports == NULL) {
+            owner->pending_ports = port;
+            port->next_pending = port;
+            port->prev_pending = port;
+        } else {
+            port->next_pending = owner->pending_ports;
+            port->prev_pending = owner->pending_ports->prev_pending;
+            owner->pending_ports->prev_pending->next_pending = port;
+            owner->pending_ports->prev_pending = port;
+        }
+    } else {
+        if (port->next_pending == port) {
+            owner->pending_ports = NULL;
+        } else {
+            if (owner->pending_ports == port)
+                owner->pending_ports = port->next_pending;
+            port->next_pending->prev_pending = port->prev_pending;
+            port->prev_pending->next_pending = port->next_pending;
+        }
+    }
+}
+
+
+/* 
+ * Returns TRUE if proc is receive blocked and willing to accept a
+ * message on port.
+ */
+BOOL is_receiving_on(PROCESS proc, PORT port)
+{
+    if (proc->state != STATE_RECEIVE_BLOCKED)
+        return FALSE;
+    if (proc->receive_port == NULL)
+        return port->open;
+    return proc->receive_port == port;
+}
+
+
+/* 
+ * Links proc into the blocked list of port. On a port that is ordered
+ * by priority, prio_tail[prio] is the last process of priority prio, so
+ * proc goes right behind the last process of its own or else of the next
+ * higher priority present.
+ */
+void link_blocked(PORT port, PROCESS proc)
+{
+    PROCESS         prev;
+    int             prio = proc->priority;
+    int             above;
+
+    if (port->prio_tail == NULL)
+        prev = port->blocked_list_tail;
+    else {
+        prev = port->prio_tail[prio];
+        if (prev == NULL) {
+            above = next_prio_bit_above(&port->blocked_prios, prio);
+            if (above >= 0)
+                prev = port->prio_tail[above];
+            set_prio_bit(&port->blocked_prios, prio);
+        }
+        port->prio_tail[prio] = proc;
+    }
+    if (prev == NULL) {
+        proc->next_blocked = port->blocked_list_head;
+        port->blocked_list_head = proc;
+    } else {
+        proc->next_blocked = prev->next_blocked;
+        prev->next_blocked = proc;
+    }
+    if (proc->next_blocked == NULL)
+        port->blocked_list_tail = proc;
+}
+
+
+void unlink_blocked(PORT port, PROCESS proc)
+{
+    PROCESS         prev;
+    int             prio = proc->priority;
+
+    if (port->blocked_list_head == proc) {
+        port->blocked_list_head = proc->next_blocked;
+        prev = NULL;
+    } else {
+        prev = port->blocked_list_head;
+        while (prev->next_blocked != proc) {
+            prev = prev->next_blocked;
+            assert(prev != NULL);
+        }
+        prev->next_blocked = proc->next_blocked;
+    }
+    if (port->blocked_list_tail == proc)
+        port->blocked_list_tail = prev;
+    if (port->prio_tail != NULL && port->prio_tail[prio] == proc) {
+        if (prev != NULL && prev->priority == prio)
+            port->prio_tail[prio] = prev;
+        else {
+            port->prio_tail[prio] = NULL;
+            clear_prio_bit(&port->blocked_prios, prio);
+        }
+    }
+}
+
+
+/* 
+ * Switches port to a blocked list that is ordered by the priority of
+ * the senders, FIFO within the same priority. Must be called before
+ * anybody blocks on port.
+ */
+void order_port_by_priority(PORT port)
+{
+    PROCESS        *prio_tail;
+    int             i;
+    volatile int    flag;
+
+    assert(port->magic == MAGIC_PORT);
+    prio_tail = (PROCESS *) malloc(MAX_READY_QUEUES * sizeof(PROCESS));
+    assert(prio_tail != NULL);
+    for (i = 0; i < MAX_READY_QUEUES; i++)
+        prio_tail[i] = NULL;
+    DISABLE_INTR(flag);
+    assert(port->blocked_list_head == NULL && port->prio_tail == NULL);
+    clear_prio_bitmap(&port->blocked_prios);
+    port->prio_tail = prio_tail;
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Changes the priority of proc. If proc waits on a port that is ordered
+ * by priority, it moves to its new place in the blocked list.
+ */
+void reprioritize(PROCESS proc, int prio)
+{
+    PORT            port = proc->blocked_port;
+
+    if ((proc->state == STATE_SEND_BLOCKED
+         || proc->state == STATE_MESSAGE_BLOCKED)
+        && port->prio_tail != NULL) {
+        unlink_blocked(port, proc);
+        change_priority(proc, prio);
+        link_blocked(port, proc);
+    } else
+        change_priority(proc, prio);
+}
+
+
+/* 
+ * A process that is blocked on a server lends its priority to it: the
+ * server runs with the highest priority among its own base priority,
+ * the processes blocked on its ports and the clients it has not yet
+ * replied to. If the server itself is blocked on another server, the
+ * priority is passed on along the chain.
+ */
+void inherit_priority(PROCESS proc, int prio)
+{
+    while (proc != NULL && proc->priority < prio) {
+        reprioritize(proc, prio);
+        proc = proc->waiting_on;
+    }
+}
+
+
+/* 
+ * Recomputes the priority of proc after one of the processes that lent
+ * its priority went away. Processes waiting for a mutex proc holds lend
+ * their priority as well.
+ */
+void update_priority(PROCESS proc)
+{
+    PORT            port;
+    MUTEX          *mutex;
+    PROCESS         p;
+    int             prio;
+
+    while (proc != NULL) {
+        prio = proc->base_priority;
+        for (port = proc->first_port; port != NULL; port = port->next)
+            for (p = port->blocked_list_head; p != NULL;
+                 p = p->next_blocked)
+                if (p->priority > prio)
+                    prio = p->priority;
+        for (p = proc->first_client; p != NULL; p = p->next_blocked)
+            if (p->priority > prio)
+                prio = p->priority;
+        for (mutex = proc->held_mutexes; mutex != NULL;
+             mutex = mutex->next_held)
+            for (p = mutex->waiting.head; p != NULL; p = p->next_blocked)
+                if (p->priority > prio)
+                    prio = p->priority;
+        if (prio == proc->priority)
+            return;
+        reprioritize(proc, prio);
+        proc = proc->waiting_on;
+    }
+}
+
+
+/* 
+ * The clients a server has received a message from but not yet replied
+ * to are linked through next_blocked, which is unused while a process
+ * is reply blocked.
+ */
+void add_client(PROCESS server, PROCESS client)
+{
+    client->waiting_on = server;
+    client->next_blocked = server->first_client;
+    server->first_client = client;
+}
+
+
+void remove_client(PROCESS server, PROCESS client)
+{
+    PROCESS        *p = &server->first_client;
+
+    while (*p != client) {
+        assert(*p != NULL);
+        p = &(*p)->next_blocked;
+    }
+    *p = client->next_blocked;
+    client->next_blocked = NULL;
+    client->waiting_on = NULL;
+}
+
+
 void add_to_send_blocked_list(PORT port, PROCESS proc)
 {
     volatile int    flag;
@@ -49,42 +344,200 @@ void add_to_send_blocked_list(PORT port, PROCESS proc)
     DISABLE_INTR(flag);
     assert(port->magic == MAGIC_PORT);
     assert(proc->magic == MAGIC_PCB);
-    if (port->blocked_list_head == NULL)
-        port->blocked_list_head = proc;
-    else
-        port->blocked_list_tail->next_blocked = proc;
-    port->blocked_list_tail = proc;
-    proc->next_blocked = NULL;
+    link_blocked(port, proc);
+    proc->blocked_port = port;
+    proc->waiting_on = port->owner;
+    update_pending_port(port);
+    inherit_priority(port->owner, proc->priority);
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Removes proc from anywhere in the send blocked list of port, e.g.
+ * because its send timed out.
+ */
+void remove_from_send_blocked_list(PORT port, PROCESS proc)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    assert(port->magic == MAGIC_PORT);
+    unlink_blocked(port, proc);
+    proc->waiting_on = NULL;
+    update_pending_port(port);
+    update_priority(port->owner);
     ENABLE_INTR(flag);
 }
 
 
+PROCESS remove_first_blocked(PORT port)
+{
+    PROCESS         proc = port->blocked_list_head;
+
+    assert(proc->magic == MAGIC_PCB);
+    unlink_blocked(port, proc);
+    update_pending_port(port);
+    return proc;
+}
+
+
 void open_port(PORT port)
 {
+    volatile int    flag;
+
     assert(port->magic == MAGIC_PORT);
+    DISABLE_INTR(flag);
     port->open = TRUE;
+    update_pending_port(port);
+    ENABLE_INTR(flag);
 }
 
 
 
 void close_port(PORT port)
 {
+    volatile int    flag;
+
     assert(port->magic == MAGIC_PORT);
+    DISABLE_INTR(flag);
     port->open = FALSE;
+    update_pending_port(port);
+    ENABLE_INTR(flag);
 }
 
 
-void send(PORT dest_port, void *data)
+/* 
+ * Attaches a ring of num_msgs buffered messages of msg_size bytes each
+ * to port. message() copies its payload into the ring and returns
+ * without blocking as long as the ring is not full. If msg_size is 0,
+ * only the data pointer passed to message() is buffered.
+ */
+void create_message_queue(PORT port, int num_msgs, int msg_size)
+{
+    int             slot_size;
+    char           *queue;
+    volatile int    flag;
+
+    assert(port->magic == MAGIC_PORT);
+    assert(num_msgs > 0 && msg_size >= 0);
+    slot_size = sizeof(MSG_SLOT) + ((msg_size + 3) & ~3);
+    /* 
+     * One extra slot: the slot handed out by the last receive() is
+     * not overwritten before the next receive().
+     */
+    queue = (char *) malloc((num_msgs + 1) * slot_size);
+    assert(queue != NULL);
+    DISABLE_INTR(flag);
+    assert(port->queue == NULL);
+    port->queue_slots = num_msgs + 1;
+    port->queue_slot_size = slot_size;
+    port->queue_head = 0;
+    port->queue_count = 0;
+    port->queue = queue;
+    ENABLE_INTR(flag);
+}
+
+
+MSG_SLOT       *get_queue_slot(PORT port, int i)
+{
+    i = (port->queue_head + i) % port->queue_slots;
+    return (MSG_SLOT *) (port->queue + i * port->queue_slot_size);
+}
+
+
+/* 
+ * Copies a message into the ring of port. The ring must not be full.
+ */
+void enqueue_message(PORT port, PROCESS sender, void *data)
+{
+    MSG_SLOT       *slot;
+
+    assert(port->queue_count < port->queue_slots - 1);
+    slot = get_queue_slot(port, port->queue_count);
+    slot->sender = sender;
+    slot->data = data;
+    if (port->queue_slot_size > sizeof(MSG_SLOT))
+        k_memcpy(slot + 1, data, port->queue_slot_size - sizeof(MSG_SLOT));
+    port->queue_count++;
+    update_pending_port(port);
+}
+
+
+/* 
+ * Removes the oldest message from the ring of port and returns the
+ * payload that is to be handed to the receiver.
+ */
+void           *dequeue_message(PORT port, PROCESS * sender)
+{
+    MSG_SLOT       *slot;
+
+    assert(port->queue_count > 0);
+    slot = get_queue_slot(port, 0);
+    port->queue_head = (port->queue_head + 1) % port->queue_slots;
+    port->queue_count--;
+    update_pending_port(port);
+    *sender = slot->sender;
+    if (port->queue_slot_size == sizeof(MSG_SLOT))
+        return slot->data;
+    return slot + 1;
+}
+
+
+BOOL message_queue_full(PORT port)
+{
+    return port->queue_count == port->queue_slots - 1;
+}
+
+
+/* 
+ * Moves the senders that message() blocked on port into the ring, in
+ * the order of the blocked list, as long as there is room. Senders
+ * waiting for a reply stay in the blocked list.
+ */
+void refill_message_queue(PORT port)
+{
+    PROCESS         proc;
+    PROCESS         next;
+
+    for (proc = port->blocked_list_head;
+         proc != NULL && !message_queue_full(port); proc = next) {
+        next = proc->next_blocked;
+        if (proc->state != STATE_MESSAGE_BLOCKED)
+            continue;
+        unlink_blocked(port, proc);
+        proc->waiting_on = NULL;
+        enqueue_message(port, proc, proc->param_data);
+        add_ready_queue(proc);
+    }
+    update_pending_port(port);
+    update_priority(port->owner);
+}
+
+
+/* 
+ * Sends data to dest_port. If ticks is not 0, the send is aborted if the
+ * receiver did not pick up the message within ticks timer ticks. Returns
+ * FALSE if the send was aborted or the receiver exited before it
+ * replied.
+ */
+BOOL send_impl(PORT dest_port, void *data, int ticks)
 {
     PROCESS         dest;
     volatile int    flag;
 
     DISABLE_INTR(flag);
     assert(dest_port->magic == MAGIC_PORT);
+    if (!dest_port->used) {
+        /* The owner of the port has exited */
+        ENABLE_INTR(flag);
+        return FALSE;
+    }
     dest = dest_port->owner;
     assert(dest->magic == MAGIC_PCB);
+    active_proc->wake_reason = WAKE_NORMAL;
 
-    if (dest_port->open && dest->state == STATE_RECEIVE_BLOCKED) {
+    if (is_receiving_on(dest, dest_port)) {
         /* 
          * Receiver is receive blocked. We can deliver our message
          * immediately.
@@ -92,6 +545,22 @@ void send(PORT dest_port, void *data)
         dest->param_proc = active_proc;
         dest->param_data = data;
         active_proc->state = STATE_REPLY_BLOCKED;
+        active_proc->param_data = data;
+        add_client(dest, active_proc);
+        inherit_priority(dest, active_proc->priority);
+        if (dest->priority >= active_proc->priority
+            && dest->priority != RT_PRIORITY) {
+            /* 
+             * Fast path: the receiver takes our place on the ready
+             * queue and we switch to it without running the
+             * dispatcher. Real-time processes are left to the
+             * dispatcher, which runs them in deadline order.
+             */
+            replace_ready_queue(active_proc, dest);
+            resign_to(dest);
+            ENABLE_INTR(flag);
+            return active_proc->wake_reason == WAKE_NORMAL;
+        }
         add_ready_queue(dest);
     } else {
         /* 
@@ -101,14 +570,40 @@ void send(PORT dest_port, void *data)
         add_to_send_blocked_list(dest_port, active_proc);
         active_proc->state = STATE_SEND_BLOCKED;
         active_proc->param_data = data;
+        if (ticks != 0)
+            add_timeout(active_proc, ticks);
     }
     active_proc->param_data = data;
     remove_ready_queue(active_proc);
     resign();
+    if (ticks != 0)
+        cancel_timeout(active_proc);
     ENABLE_INTR(flag);
+    return active_proc->wake_reason == WAKE_NORMAL;
 }
 
 
+void send(PORT dest_port, void *data)
+{
+    send_impl(dest_port, data, 0);
+}
+
+
+/* 
+ * Like send(), but gives up if the receiver does not accept the message
+ * within ticks timer ticks. Returns FALSE in that case.
+ */
+BOOL send_timeout(PORT dest_port, void *data, int ticks)
+{
+    assert(ticks > 0);
+    return send_impl(dest_port, data, ticks);
+}
+
+
+/* 
+ * Sends data to dest_port without waiting for a reply. Messages to a
+ * process that has exited are dropped.
+ */
 void message(PORT dest_port, void *data)
 {
     PROCESS         dest;
@@ -116,10 +611,30 @@ void message(PORT dest_port, void *data)
 
     DISABLE_INTR(flag);
     assert(dest_port->magic == MAGIC_PORT);
+    if (!dest_port->used) {
+        /* The owner of the port has exited */
+        ENABLE_INTR(flag);
+        return;
+    }
     dest = dest_port->owner;
     assert(dest->magic == MAGIC_PCB);
 
-    if (dest_port->open && dest->state == STATE_RECEIVE_BLOCKED) {
+    if (dest_port->queue != NULL && !message_queue_full(dest_port)
+        && dest_port->blocked_list_head == NULL) {
+        /* 
+         * Buffer the message. Only yield if this woke up a receiver
+         * that is more important than we are. If others are blocked
+         * on the port, we queue up behind them so that they are not
+         * overtaken.
+         */
+        try_message(dest_port, data);
+        if (dest->state == STATE_READY
+            && dest->priority > active_proc->priority)
+            resign();
+        ENABLE_INTR(flag);
+        return;
+    }
+    if (is_receiving_on(dest, dest_port)) {
         dest->param_proc = active_proc;
         dest->param_data = data;
         add_ready_queue(dest);
@@ -139,7 +654,80 @@ void message(PORT dest_port, void *data)
 
 
 
-void           *receive(PROCESS * sender)
+/* 
+ * Delivers data from sender to dest_port without blocking. Returns
+ * FALSE if the message could not be delivered immediately or the owner
+ * of dest_port has exited. A process does not overtake the senders
+ * blocked on dest_port; interrupt handlers (sender NULL) cannot wait
+ * and may use a free slot of the ring anyway.
+ */
+BOOL deliver_message(PORT dest_port, PROCESS sender, void *data)
+{
+    PROCESS         dest;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    assert(dest_port->magic == MAGIC_PORT);
+    if (!dest_port->used) {
+        ENABLE_INTR(flag);
+        return FALSE;
+    }
+    dest = dest_port->owner;
+    assert(dest->magic == MAGIC_PCB);
+    if (sender != NULL && dest_port->blocked_list_head != NULL) {
+        ENABLE_INTR(flag);
+        return FALSE;
+    }
+    if (dest_port->queue != NULL && !message_queue_full(dest_port)) {
+        enqueue_message(dest_port, sender, data);
+        if (is_receiving_on(dest, dest_port)) {
+            dest->param_data = dequeue_message(dest_port,
+                                               &dest->param_proc);
+            add_ready_queue(dest);
+        }
+    } else if (is_receiving_on(dest, dest_port)) {
+        dest->param_proc = sender;
+        dest->param_data = data;
+        add_ready_queue(dest);
+    } else {
+        ENABLE_INTR(flag);
+        return FALSE;
+    }
+    ENABLE_INTR(flag);
+    return TRUE;
+}
+
+
+/* 
+ * Delivers data to dest_port like message(), but never blocks nor
+ * yields the CPU. Returns FALSE if the message could not be delivered
+ * immediately.
+ */
+BOOL try_message(PORT dest_port, void *data)
+{
+    return deliver_message(dest_port, active_proc, data);
+}
+
+
+/* 
+ * Like try_message(), but for interrupt handlers and tasklets, which do
+ * not run on behalf of active_proc. The receiver sees a NULL sender.
+ */
+BOOL post_message(PORT dest_port, void *data)
+{
+    return deliver_message(dest_port, NULL, data);
+}
+
+
+/* 
+ * Receives the next message for active_proc, only from port from if it
+ * is not NULL. If no message is pending and next is not NULL, the CPU
+ * is handed directly to next (which must be ready) instead of running
+ * the dispatcher. If ticks is not 0, NULL is returned with *sender set
+ * to NULL if no message arrived within ticks timer ticks.
+ */
+void           *receive_impl(PORT from, PROCESS * sender, PROCESS next,
+                             int ticks)
 {
     PROCESS         deliver_proc;
     PORT            port;
@@ -148,31 +736,46 @@ void           *receive(PROCESS * sender)
 
     DISABLE_INTR(flag);
     data = NULL;
-    port = active_proc->first_port;
-    if (port == NULL)
+    if (active_proc->first_port == NULL)
         panic("receive(): no port created for this process");
-    while (port != NULL) {
-        assert(port->magic == MAGIC_PORT);
-        if (port->open && port->blocked_list_head != NULL)
-            break;
-        port = port->next;
+    if (from == NULL) {
+        port = active_proc->pending_ports;
+    } else {
+        assert(from->magic == MAGIC_PORT);
+        assert(from->owner == active_proc);
+        port = from;
+        if (port->queue_count == 0 && port->blocked_list_head == NULL)
+            port = NULL;
     }
 
     if (port != NULL) {
-        deliver_proc = port->blocked_list_head;
-        assert(deliver_proc->magic == MAGIC_PCB);
+        /* Serve the pending ports round robin */
+        if (from == NULL)
+            active_proc->pending_ports = port->next_pending;
+
+        if (port->queue_count != 0) {
+            /* Buffered messages are delivered first */
+            data = dequeue_message(port, sender);
+            refill_message_queue(port);
+            ENABLE_INTR(flag);
+            return data;
+        }
+
+        deliver_proc = remove_first_blocked(port);
         *sender = deliver_proc;
         data = deliver_proc->param_data;
-        port->blocked_list_head = port->blocked_list_head->next_blocked;
-        if (port->blocked_list_head == NULL)
-            port->blocked_list_tail = NULL;
 
         if (deliver_proc->state == STATE_MESSAGE_BLOCKED) {
+            deliver_proc->waiting_on = NULL;
             add_ready_queue(deliver_proc);
+            update_priority(active_proc);
             ENABLE_INTR(flag);
             return data;
         } else if (deliver_proc->state == STATE_SEND_BLOCKED) {
+            /* The message was accepted; a send timeout no longer applies */
+            cancel_timeout(deliver_proc);
             deliver_proc->state = STATE_REPLY_BLOCKED;
+            add_client(active_proc, deliver_proc);
             ENABLE_INTR(flag);
             return data;
         }
@@ -181,8 +784,16 @@ void           *receive(PROCESS * sender)
     /* No messages pending */
     remove_ready_queue(active_proc);
     active_proc->param_data = data;
+    active_proc->receive_port = from;
     active_proc->state = STATE_RECEIVE_BLOCKED;
-    resign();
+    if (ticks != 0)
+        add_timeout(active_proc, ticks);
+    if (next != NULL)
+        resign_to(next);
+    else
+        resign();
+    if (ticks != 0)
+        cancel_timeout(active_proc);
     *sender = active_proc->param_proc;
     data = active_proc->param_data;
     ENABLE_INTR(flag);
@@ -190,15 +801,178 @@ void           *receive(PROCESS * sender)
 }
 
 
+void           *receive(PROCESS * sender)
+{
+    return receive_impl(NULL, sender, NULL, 0);
+}
+
+
+/* 
+ * Like receive(), but only accepts messages sent to port. The port
+ * does not need to be open.
+ */
+void           *receive_from(PORT port, PROCESS * sender)
+{
+    return receive_impl(port, sender, NULL, 0);
+}
+
+
+/* 
+ * Like receive(), but gives up after ticks timer ticks. Returns NULL
+ * and sets *sender to NULL in that case.
+ */
+void           *receive_timeout(PROCESS * sender, int ticks)
+{
+    assert(ticks > 0);
+    return receive_impl(NULL, sender, NULL, ticks);
+}
+
+
+/* 
+ * Combination of receive_from() and receive_timeout().
+ */
+void           *receive_from_timeout(PORT port, PROCESS * sender, int ticks)
+{
+    assert(ticks > 0);
+    return receive_impl(port, sender, NULL, ticks);
+}
+
+
 void reply(PROCESS sender)
 {
+    PROCESS         server;
     volatile int    flag;
 
     DISABLE_INTR(flag);
     if (sender->state != STATE_REPLY_BLOCKED)
         panic("reply(): Not reply blocked");
+    /* Give back the priority inherited from sender */
+    server = sender->waiting_on;
+    remove_client(server, sender);
+    update_priority(server);
     add_ready_queue(sender);
-    resign();
+    if (sender->priority >= active_proc->priority
+        && sender->priority != RT_PRIORITY)
+        /* Fast path: hand the CPU straight back to the client */
+        resign_to(sender);
+    else
+        resign();
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Replies to sender and waits for the next message in a single
+ * transition. A client of higher priority runs first; a client of
+ * equal priority gets the CPU directly if the server has to block.
+ * A real-time client is left to the dispatcher.
+ */
+void           *reply_and_receive(PROCESS sender, PROCESS * next_sender)
+{
+    PROCESS         server;
+    void           *data;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (sender->state != STATE_REPLY_BLOCKED)
+        panic("reply_and_receive(): Not reply blocked");
+    server = sender->waiting_on;
+    remove_client(server, sender);
+    update_priority(server);
+    add_ready_queue(sender);
+    if (sender->priority == RT_PRIORITY) {
+        resign();
+        data = receive_impl(NULL, next_sender, NULL, 0);
+    } else if (sender->priority > active_proc->priority) {
+        resign_to(sender);
+        data = receive_impl(NULL, next_sender, NULL, 0);
+    } else if (sender->priority == active_proc->priority) {
+        data = receive_impl(NULL, next_sender, sender, 0);
+    } else {
+        data = receive_impl(NULL, next_sender, NULL, 0);
+    }
+    ENABLE_INTR(flag);
+    return data;
+}
+
+
+/* 
+ * Sends data to dest_port and blocks until the receiver replied. The
+ * reply is passed back in place, so data is returned for convenience.
+ * Returns NULL if the receiver exited before it replied.
+ */
+void           *call(PORT dest_port, void *data)
+{
+    if (!send_impl(dest_port, data, 0))
+        return NULL;
+    return data;
+}
+
+
+/* 
+ * Wakes up proc, which is blocked on a process that exits, with
+ * WAKE_PEER_EXITED.
+ */
+void wake_orphaned(PROCESS proc)
+{
+    cancel_timeout(proc);
+    proc->waiting_on = NULL;
+    proc->wake_reason = WAKE_PEER_EXITED;
+    add_ready_queue(proc);
+}
+
+
+/* 
+ * release_ports
+ *----------------------------------------------------------------------------
+ * Called when proc exits. Wakes up everybody who is blocked on one of
+ * its ports or waits for a reply from it, then returns all its ports
+ * to the free list. Messages that were not received are dropped. Must
+ * not be called with interrupts disabled since free() may block.
+ */
+
+void release_ports(PROCESS proc)
+{
+    PORT            ports;
+    PORT            p;
+    PORT            next;
+    PROCESS         client;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    while ((client = proc->first_client) != NULL) {
+        proc->first_client = client->next_blocked;
+        client->next_blocked = NULL;
+        wake_orphaned(client);
+    }
+    for (p = proc->first_port; p != NULL; p = p->next) {
+        while (p->blocked_list_head != NULL)
+            wake_orphaned(remove_first_blocked(p));
+        p->used = FALSE;
+        p->open = FALSE;
+        p->pending = FALSE;
+    }
+    ports = proc->first_port;
+    proc->first_port = NULL;
+    proc->pending_ports = NULL;
+    ENABLE_INTR(flag);
+
+    /* Nobody uses the ports any more, but they are not free yet */
+    for (p = ports; p != NULL; p = p->next) {
+        if (p->queue != NULL)
+            free(p->queue);
+        if (p->prio_tail != NULL)
+            free(p->prio_tail);
+        p->queue = NULL;
+        p->prio_tail = NULL;
+    }
+
+    DISABLE_INTR(flag);
+    for (p = ports; p != NULL; p = next) {
+        next = p->next;
+        p->next = next_free_port;
+        next_free_port = p;
+    }
     ENABLE_INTR(flag);
 }
 
@@ -206,8 +980,12 @@ void reply(PROCESS sender)
 void init_ipc()
 {
     int             i;
+    PORT_SLAB      *slab;
 
-    next_free_port = port;
+    /* Hand out the static ports first */
+    next_free_port = NULL;
+    for (slab = port_slabs; slab != NULL; slab = slab->next)
+        free_port_slab(slab);
     for (i = 0; i < MAX_PORTS - 1; i++) {
         port[i].used = FALSE;
         port[i].magic = MAGIC_PORT;
@@ -215,5 +993,6 @@ void init_ipc()
     }
     port[MAX_PORTS - 1].used = FALSE;
     port[MAX_PORTS - 1].magic = MAGIC_PORT;
-    port[MAX_PORTS - 1].next = NULL;
+    port[MAX_PORTS - 1].next = next_free_port;
+    next_free_port = port;
 }
@@ -19,9 +19,7 @@ static unsigned ignore = 0;
 /* Variables indicating keys */
 static unsigned char control = 0;
 static unsigned char shift = 0;
-static unsigned char new_char;
 static unsigned new_key;
-static char     value;
 
 static char     done;
 static unsigned char special = 0;
@@ -171,25 +169,74 @@ unsigned get_keycode(unsigned char ch)
 }
 
 
-void keyb_notifier(PROCESS self, PARAM param)
-{
-    Keyb_Message    msg;
+/* 
+ * Scancodes read by the ISR, waiting to be decoded by the tasklet.
+ */
+#define SCANCODE_RING   16
+
+static unsigned char scancodes[SCANCODE_RING];
+static int      scancode_head = 0;
+static int      scancode_count = 0;
+static TASKLET  keyb_tasklet;
 
-    while (1) {
-        wait_for_interrupt(KEYB_IRQ);
 
-        new_char = inportb(KEYBD);
+/* 
+ * Keyboard ISR: fetches the scancode and defers the decoding.
+ */
+void keyb_irq(int intr_no)
+{
+    unsigned char   scancode;
+    char            value;
+
+    scancode = inportb(KEYBD);
 #if 0
-        kprintf("%02X ", new_char);
+    kprintf("%02X ", scancode);
 #endif
-        value = inportb(PORT_B);
-        value |= KBIT;
-        outportb(PORT_B, value);
-        value &= 0x7f;
-        outportb(PORT_B, value);
-
-        outportb(PORT_B, value | KBIT);
-        outportb(PORT_B, value);
+    value = inportb(PORT_B);
+    value |= KBIT;
+    outportb(PORT_B, value);
+    value &= 0x7f;
+    outportb(PORT_B, value);
+
+    outportb(PORT_B, value | KBIT);
+    outportb(PORT_B, value);
+
+    if (scancode_count == SCANCODE_RING) {
+        irq_stats[intr_no - IRQ_BASE].lost++;
+        return;
+    }
+    scancodes[(scancode_head + scancode_count++) % SCANCODE_RING] =
+        scancode;
+    schedule_tasklet(&keyb_tasklet);
+}
+
+
+BOOL next_scancode(unsigned char *scancode)
+{
+    volatile int    flag;
+    BOOL            found = FALSE;
+
+    DISABLE_INTR(flag);
+    if (scancode_count > 0) {
+        *scancode = scancodes[scancode_head];
+        scancode_head = (scancode_head + 1) % SCANCODE_RING;
+        scancode_count--;
+        found = TRUE;
+    }
+    ENABLE_INTR(flag);
+    return found;
+}
+
+
+/* 
+ * Tasklet that turns the buffered scancodes into keystrokes for the
+ * keyboard process.
+ */
+void keyb_decode(void *data)
+{
+    unsigned char   new_char;
+
+    while (next_scancode(&new_char)) {
         done = FALSE;
 
         if ((new_char == 0xE1) && !ignore) {    /* For weird scancodes */
@@ -279,9 +326,8 @@ void keyb_notifier(PROCESS self, PARAM param)
 
         if (!done && ((new_key = get_keycode(new_char)) != 0)) {
             /* we actually have a new keystroke. Send it to the keyboard
-             * process */
-            msg.key_buffer = (char *) &new_key;
-            message(keyb_port, &msg);
+             * process, it is dropped if its buffer is full */
+            post_message(keyb_port, &new_key);
         }
 
         if (special)
@@ -291,7 +337,6 @@ void keyb_notifier(PROCESS self, PARAM param)
         /* after due number of scan codes */
 
     }
-    become_zombie();
 }
 
 
@@ -393,54 +438,66 @@ void keyb_process(PROCESS self, PARAM param)
 {
     Keyb_Message   *msg;
     PROCESS         sender_proc;
-    PORT            keyb_notifier_port;
-    PROCESS         keyb_notifier_proc;
 
-    keyb_notifier_port =
-        create_process(keyb_notifier, 7, 0, "Keyboard Notifier");
-    keyb_notifier_proc = keyb_notifier_port->owner;
+    /* 
+     * Keystrokes from the keyboard tasklet are buffered so that they
+     * are not lost while we are busy with a client.
+     */
+    create_message_queue(keyb_port, 16, sizeof(new_key));
+    /* Waiting clients are served by priority */
+    order_port_by_priority(keyb_port);
+
+    init_tasklet(&keyb_tasklet, keyb_decode, NULL);
+    register_irq_handler(KEYB_IRQ, keyb_irq);
 
+    msg = (Keyb_Message *) receive(&sender_proc);
     while (1) {
-        msg = (Keyb_Message *) receive(&sender_proc);
-        if (sender_proc == keyb_notifier_proc) {
-            /* the notifier has sent us a new keystroke */
-            char            key = *msg->key_buffer;
-            if (keyb_handle_control(key)) {
-                continue;
-            }
-            if (current_window == -1) {
-                current_window = wm_current_focus();
-                if (current_window == -1) {
-                    // No window exists. Just discard key
-                    continue;
+        if (sender_proc == NULL) {
+            /* the tasklet has sent us a new keystroke */
+            char            key = *(unsigned *) msg;
+            if (!keyb_handle_control(key)) {
+                if (current_window == -1)
+                    current_window = wm_current_focus();
+                // If no window exists just discard key
+                if (current_window != -1) {
+                    KEYB_CLIENT    *record =
+                        get_client_record(current_window);
+                    if (record->is_waiting) {
+                        *record->msg->key_buffer = key;
+                        record->is_waiting = FALSE;
+                        // The tasklet did not block on us, so reply
+                        // to the waiting client and get the next
+                        // message in one go
+                        msg = (Keyb_Message *)
+                            reply_and_receive(record->client,
+                                              &sender_proc);
+                        continue;
+                    }
+                    enqueue_key(record, key);
                 }
             }
-            KEYB_CLIENT    *record = get_client_record(current_window);
-            if (record->is_waiting) {
-                *record->msg->key_buffer = key;
-                reply(record->client);
-                record->is_waiting = FALSE;
-            } else {
-                enqueue_key(record, key);
-            }
         } else {
             // Message is from a client
             KEYB_CLIENT    *record = get_client_record(msg->window_id);
             if (has_key_enqueued(record)) {
                 *msg->key_buffer = dequeue_key(record);
-                reply(sender_proc);
+                msg = (Keyb_Message *) reply_and_receive(sender_proc,
+                                                         &sender_proc);
+                continue;
+            }
+            if (msg->block) {
+                record->client = sender_proc;
+                record->msg = msg;
+                record->is_waiting = TRUE;
             } else {
-                if (msg->block) {
-                    record->client = sender_proc;
-                    record->msg = msg;
-                    record->is_waiting = TRUE;
-                } else {
-                    // No key and also don't block. Reply immediately
-                    *msg->key_buffer = 0;
-                    reply(sender_proc);
-                }
+                // No key and also don't block. Reply immediately
+                *msg->key_buffer = 0;
+                msg = (Keyb_Message *) reply_and_receive(sender_proc,
+                                                         &sender_proc);
+                continue;
             }
         }
+        msg = (Keyb_Message *) receive(&sender_proc);
     }
     become_zombie();
 }
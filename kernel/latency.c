@@ -0,0 +1,274 @@
+#include <kernel.h>
+
+
+/*
+ * Interrupts-off latency tracer. With -DTRACE_INTR_LATENCY, DISABLE_INTR()
+ * and ENABLE_INTR() report to trace_intr_off() and trace_intr_on(). A
+ * section starts when DISABLE_INTR() turns interrupts off and ends when
+ * ENABLE_INTR() turns them back on, possibly in another process if the
+ * CPU switched in between. Nested pairs are part of the outer section.
+ *
+ * For each DISABLE_INTR() call site the longest section is kept; when
+ * the table is full, the site with the shortest one is dropped. Time
+ * spent in interrupt handlers before they enable interrupts and code
+ * that uses cli/sti directly are not covered.
+ */
+
+#define EFLAGS_IF       0x200
+
+#ifdef TRACE_INTR_LATENCY
+
+/* Open section of a CPU */
+typedef struct {
+    BOOL            open;
+    unsigned long long tsc;
+    const char     *file;
+    int             line;
+} OFF_SECTION;
+
+static OFF_SECTION off_sections[MAX_CPUS];
+
+static INTR_LATENCY records[INTR_LATENCY_RECORDS];
+static int      num_records = 0;
+
+
+static OFF_SECTION *current_section()
+{
+#ifdef SMP
+    return &off_sections[this_cpu()->index];
+#else
+    return &off_sections[0];
+#endif
+}
+
+
+static void record_section(OFF_SECTION * off, const char *file, int line,
+                           unsigned cycles)
+{
+    INTR_LATENCY   *rec;
+    int             i;
+
+    for (i = 0; i < num_records; i++) {
+        rec = &records[i];
+        if (rec->off_file == off->file && rec->off_line == off->line) {
+            rec->count++;
+            if (cycles > rec->max_cycles) {
+                rec->max_cycles = cycles;
+                rec->on_file = file;
+                rec->on_line = line;
+            }
+            return;
+        }
+    }
+
+    if (num_records < INTR_LATENCY_RECORDS)
+        rec = &records[num_records++];
+    else {
+        rec = &records[0];
+        for (i = 1; i < num_records; i++)
+            if (records[i].max_cycles < rec->max_cycles)
+                rec = &records[i];
+        if (cycles <= rec->max_cycles)
+            return;
+    }
+    rec->off_file = off->file;
+    rec->off_line = off->line;
+    rec->on_file = file;
+    rec->on_line = line;
+    rec->max_cycles = cycles;
+    rec->count = 1;
+}
+
+
+/*
+ * trace_intr_off
+ *----------------------------------------------------------------------------
+ * Called by DISABLE_INTR() after cli. flags are the saved EFLAGS.
+ */
+
+void trace_intr_off(int flags, const char *file, int line)
+{
+    OFF_SECTION    *off;
+
+    if (!(flags & EFLAGS_IF))
+        return;
+    off = current_section();
+    off->open = TRUE;
+    off->file = file;
+    off->line = line;
+    off->tsc = read_tsc();
+}
+
+
+/*
+ * trace_intr_on
+ *----------------------------------------------------------------------------
+ * Called by ENABLE_INTR() before it restores flags.
+ */
+
+void trace_intr_on(int flags, const char *file, int line)
+{
+    OFF_SECTION    *off;
+    unsigned long long cycles;
+
+    if (!(flags & EFLAGS_IF))
+        return;
+    off = current_section();
+    if (!off->open)
+        return;
+    cycles = read_tsc() - off->tsc;
+    off->open = FALSE;
+    record_section(off, file, line,
+                   cycles > 0xffffffff ? 0xffffffff : (unsigned) cycles);
+}
+
+
+/*
+ * trace_intr_irq
+ *----------------------------------------------------------------------------
+ * Called on every IRQ. Interrupts were on when it came in, so whatever
+ * section the CPU had open was left without ENABLE_INTR(), e.g. by an
+ * iret into another process.
+ */
+
+void trace_intr_irq()
+{
+    current_section()->open = FALSE;
+}
+
+#endif
+
+
+/*
+ * get_intr_latency
+ *----------------------------------------------------------------------------
+ * Copies the recorded sections, longest first, to copy, which has
+ * room for INTR_LATENCY_RECORDS entries. Returns their number, or -1 if
+ * the kernel was built without TRACE_INTR_LATENCY.
+ */
+
+int get_intr_latency(INTR_LATENCY * copy)
+{
+#ifdef TRACE_INTR_LATENCY
+    INTR_LATENCY    rec;
+    int             n;
+    int             i;
+    int             j;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    n = num_records;
+    for (i = 0; i < n; i++)
+        copy[i] = records[i];
+    ENABLE_INTR(flag);
+
+    for (i = 1; i < n; i++) {
+        rec = copy[i];
+        for (j = i; j > 0 && copy[j - 1].max_cycles < rec.max_cycles; j--)
+            copy[j] = copy[j - 1];
+        copy[j] = rec;
+    }
+    return n;
+#else
+    return -1;
+#endif
+}
+
+
+void reset_intr_latency()
+{
+#ifdef TRACE_INTR_LATENCY
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    num_records = 0;
+    ENABLE_INTR(flag);
+#endif
+}
+
+
+static void format_line(char *buf, const char *fmt, ...)
+{
+    va_list         argp;
+
+    va_start(argp, fmt);
+    vsprintf(buf, fmt, argp);
+    va_end(argp);
+}
+
+
+/*
+ * Formats line n of the report into buf, without a line break. Returns
+ * FALSE after the last line. Durations are in microseconds once the TSC
+ * is calibrated (see timer.c), in TSC cycles before.
+ */
+static BOOL format_report(char *buf, int n, INTR_LATENCY * copy,
+                          int num_copied)
+{
+    INTR_LATENCY   *rec;
+    unsigned        duration;
+
+    if (num_copied < 0) {
+        if (n > 0)
+            return FALSE;
+        format_line(buf, "Kernel built without TRACE_INTR_LATENCY.");
+        return TRUE;
+    }
+    if (n == 0) {
+        format_line(buf, "Disabled at       %s  Count  Enabled at",
+                    cycles_per_tick != 0 ? "    Max us" : "Max cycles");
+        return TRUE;
+    }
+    if (n > num_copied)
+        return FALSE;
+
+    rec = &copy[n - 1];
+    duration = rec->max_cycles;
+    if (cycles_per_tick != 0)
+        duration = mul_div(duration, NS_PER_TICK / 1000, cycles_per_tick);
+    format_line(buf, "%12s:%-4d %10u %6u  %s:%d", rec->off_file,
+                rec->off_line, duration, rec->count, rec->on_file,
+                rec->on_line);
+    return TRUE;
+}
+
+
+/*
+ * print_intr_latency
+ *----------------------------------------------------------------------------
+ * Prints the longest interrupts-off sections to a window.
+ */
+
+void print_intr_latency(int window_id)
+{
+    INTR_LATENCY    copy[INTR_LATENCY_RECORDS];
+    int             n;
+    int             i;
+    char            buf[100];
+
+    n = get_intr_latency(copy);
+    for (i = 0; format_report(buf, i, copy, n); i++)
+        wm_print(window_id, "%s\n", buf);
+}
+
+
+/*
+ * dump_intr_latency
+ *----------------------------------------------------------------------------
+ * Writes the same report to COM1. The output goes straight to the UART,
+ * so it must not be used while the COM process talks to the train.
+ */
+
+void dump_intr_latency()
+{
+    INTR_LATENCY    copy[INTR_LATENCY_RECORDS];
+    int             n;
+    int             i;
+    char            buf[100];
+
+    n = get_intr_latency(copy);
+    for (i = 0; format_report(buf, i, copy, n); i++) {
+        send_cmd_to_com(buf);
+        send_cmd_to_com("\r\n");
+    }
+}
@@ -11,12 +11,18 @@ void kernel_main()
     outportb(0x03D4, 0x0F);
     outportb(0x03D5, 0xFF);
 
+#ifdef SMP
+    init_smp();
+#endif
     init_process();
     init_dispatcher();
     init_ipc();
     init_interrupts();
     init_null_process();
     init_timer();
+#ifdef SMP
+    start_aps();
+#endif
     init_com();
     init_wm();
     init_keyb();
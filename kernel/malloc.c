@@ -43,6 +43,12 @@ struct block_meta {
 
 void           *global_base = NULL;
 
+/*
+ * Serializes the heap. The first-fit walk can be long, so it runs with
+ * interrupts enabled.
+ */
+static MUTEX    heap_lock = MUTEX_INIT;
+
 // Iterate through blocks until we find one that's large enough.
 // TODO: split block up if it's larger than necessary
 struct block_meta *find_free_block(struct block_meta **last, size_t size)
@@ -114,11 +120,9 @@ void           *malloc_impl(size_t size)
 
 void           *malloc(size_t size)
 {
-    volatile int    flag;
-
-    DISABLE_INTR(flag);
+    mutex_lock(&heap_lock);
     void           *ptr = malloc_impl(size);
-    ENABLE_INTR(flag);
+    mutex_unlock(&heap_lock);
     return ptr;
 }
 
@@ -152,11 +156,9 @@ void free_impl(void *ptr)
 
 void free(void *ptr)
 {
-    volatile int    flag;
-
-    DISABLE_INTR(flag);
+    mutex_lock(&heap_lock);
     free_impl(ptr);
-    ENABLE_INTR(flag);
+    mutex_unlock(&heap_lock);
 }
 
 void           *realloc_impl(void *ptr, size_t size)
@@ -183,12 +185,9 @@ void           *realloc_impl(void *ptr, size_t size)
     return new_ptr;
 }
 
+// realloc_impl() only touches the heap through malloc() and free(), which
+// take heap_lock themselves.
 void           *realloc(void *ptr, size_t size)
 {
-    volatile int    flag;
-
-    DISABLE_INTR(flag);
-    void           *rptr = realloc_impl(ptr, size);
-    ENABLE_INTR(flag);
-    return rptr;
+    return realloc_impl(ptr, size);
 }
@@ -1,15 +1,55 @@
-
 #include <kernel.h>
 
 
 void null_process(PROCESS self, PARAM param)
 {
-    while (42);
+#ifndef SMP
+    volatile int    flag;
+#endif
+
+    while (42) {
+        if (!interrupts_initialized)
+            continue;
+#ifdef SMP
+        /* 
+         * Every CPU has its own idle process outside the ready queue.
+         * It looks for work after each interrupt, including the local
+         * timer tick, and must not halt with the kernel lock held.
+         */
+        resign();
+        asm("sti;hlt");
+#else
+        DISABLE_INTR(flag);
+        /* 
+         * Nothing else can run until an interrupt makes a process
+         * ready, so the periodic timer interrupt can be stopped.
+         */
+        if (is_only_ready(self))
+            start_tickless();
+        /* 
+         * sti only takes effect after the next instruction, so an
+         * interrupt cannot slip in before hlt.
+         */
+        asm("sti;hlt");
+        ENABLE_INTR(flag);
+#endif
+    }
     become_zombie();
 }
 
 
 void init_null_process()
 {
+#ifdef SMP
+    PORT            port;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    port = create_process(null_process, 0, 0, "Null process");
+    cpus[BOOT_CPU].idle = port->owner;
+    remove_ready_queue(port->owner);
+    ENABLE_INTR(flag);
+#else
     create_process(null_process, 0, 0, "Null process");
+#endif
 }
@@ -167,7 +167,7 @@ BOOL move_ghost(GHOST * ghost, int dx, int dy)
 }
 
 
-void create_new_ghost()
+void ghost_fiber(FIBER self, PARAM param)
 {
     GHOST           ghost;
     int             dx,
@@ -177,7 +177,7 @@ void create_new_ghost()
     choose_random_direction(&dx, &dy);
 
     while (1) {
-        sleep(10);
+        fiber_sleep(self, MS_TO_TICKS(550));
         while (move_ghost(&ghost, dx, dy) == FALSE)
             choose_random_direction(&dx, &dy);
     }
@@ -186,7 +186,13 @@ void create_new_ghost()
 
 void ghost_proc(PROCESS self, PARAM param)
 {
-    create_new_ghost();
+    FIBER_HOST      ghosts;
+    int             i;
+
+    init_fiber_host(&ghosts);
+    for (i = 0; i < (int) param; i++)
+        create_fiber(&ghosts, ghost_fiber, 0, FIBER_STACK_SIZE);
+    run_fibers(&ghosts);
     become_zombie();
 }
 
@@ -200,8 +206,5 @@ void init_pacman(WINDOW * wnd, int num_ghosts)
 
     draw_maze();
 
-    int             i;
-    for (i = 0; i < num_ghosts; i++)
-        create_process(ghost_proc, 3, 0, "Ghost");
-    return;
+    create_process(ghost_proc, 3, (PARAM) num_ghosts, "Ghosts");
 }
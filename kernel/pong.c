@@ -39,12 +39,12 @@ void show_game_over(int window_id, char *buffer)
     int             x = (PONG_WINDOW_WIDTH - k_strlen(msg)) / 2;
     int             y = PONG_WINDOW_HEIGHT / 2;
     for (int i = 0; i < 10; i++) {
-        sleep(10);
+        sleep(MS_TO_TICKS(550));
         clear_buffer(buffer);
         wm_set_cursor(window_id, x, y, 0);
         wm_print(window_id, msg);
         wm_redraw_window(window_id);
-        sleep(10);
+        sleep(MS_TO_TICKS(550));
         fill_buffer(buffer);
         wm_set_cursor(window_id, x, y, 0);
         wm_print(window_id, msg);
@@ -117,7 +117,7 @@ void pong_process(PROCESS self, PARAM param)
             draw_racket(buffer, racket);
             buffer[y * PONG_WINDOW_WIDTH + x] = PONG_BALL_CHAR;
             wm_redraw_window(window_id);
-            sleep(5);
+            sleep(MS_TO_TICKS(275));
             state = PONG_STATE_MOVE;
             break;
         case PONG_STATE_GAME_OVER:
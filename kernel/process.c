@@ -5,34 +5,145 @@
 PCB             pcb[MAX_PROCS];
 PCB            *next_free_pcb;
 
+/* 
+ * All PCB slots, starting with pcb[], are chained through next_slot.
+ * Slabs are appended at last_slot and are never returned to the heap;
+ * init_process() recycles them.
+ */
+PCB            *last_slot = NULL;
+
+/* 
+ * Processes that exited but whose PCB and stack are not yet reclaimed,
+ * linked through next.
+ */
+PCB            *zombie_list = NULL;
+
+
+/* 
+ * Allocates a slab of PCB_SLAB_SIZE PCB's from the heap and puts them
+ * on the free list. malloc() may block, so this must not be called
+ * with interrupts disabled.
+ */
+void grow_pcb_pool()
+{
+    PCB            *slab;
+    int             i;
+    volatile int    flag;
+
+    slab = (PCB *) malloc(PCB_SLAB_SIZE * sizeof(PCB));
+    if (slab == NULL)
+        panic("create(): PCB full");
+    for (i = 0; i < PCB_SLAB_SIZE; i++) {
+        slab[i].magic = 0;
+        slab[i].used = FALSE;
+        slab[i].next_slot = &slab[i + 1];
+        slab[i].next = &slab[i + 1];
+    }
+    slab[PCB_SLAB_SIZE - 1].next_slot = NULL;
+    DISABLE_INTR(flag);
+    slab[PCB_SLAB_SIZE - 1].next = next_free_pcb;
+    last_slot->next_slot = slab;
+    last_slot = &slab[PCB_SLAB_SIZE - 1];
+    next_free_pcb = slab;
+    ENABLE_INTR(flag);
+}
+
 
 PORT create_process(void (*ptr_to_new_proc) (PROCESS, PARAM),
                     int prio, PARAM param, char *name)
 {
-    MEM_ADDR        esp;
+    return create_process_with_stack(ptr_to_new_proc, prio, param, name,
+                                     DEFAULT_STACK_SIZE);
+}
+
+
+/* 
+ * Returns the linear address just above the stack of proc.
+ */
+MEM_ADDR stack_top(PROCESS proc)
+{
+    if (proc->stack_base != 0)
+        return proc->stack_base + proc->stack_size;
+    return 640 * 1024 - (proc - pcb) * DEFAULT_STACK_SIZE;
+}
+
+
+/* 
+ * Allocates a PCB with a port and a stack of stack_size bytes for a new
+ * process. Processes in one of the static PCB's with the default stack
+ * size use a stack below 640 KB; all others get their stack from the
+ * heap. The caller sets up the stack and puts the process on the ready
+ * queue.
+ */
+PROCESS new_process(int prio, char *name, int stack_size)
+{
     PROCESS         new_proc;
-    PORT            new_port;
     volatile int    flag;
 
-    DISABLE_INTR(flag);
-    if (prio >= MAX_READY_QUEUES)
+    if (prio >= RT_PRIORITY)
         panic("create(): Bad priority");
-    if (next_free_pcb == NULL)
-        panic("create(): PCB full");
+    if (stack_size < MIN_STACK_SIZE)
+        panic("create(): Bad stack size");
+    reap_zombies();
+    DISABLE_INTR(flag);
+    while (next_free_pcb == NULL) {
+        ENABLE_INTR(flag);
+        grow_pcb_pool();
+        DISABLE_INTR(flag);
+    }
     new_proc = next_free_pcb;
     next_free_pcb = new_proc->next;
     ENABLE_INTR(flag);
     new_proc->used = TRUE;
     new_proc->magic = MAGIC_PCB;
     new_proc->state = STATE_READY;
+    new_proc->cpu = NO_CPU;
+    new_proc->lock_depth = 0;
     new_proc->priority = prio;
+    new_proc->base_priority = prio;
+    new_proc->waiting_on = NULL;
+    new_proc->first_client = NULL;
+    new_proc->held_mutexes = NULL;
+    new_proc->parent = active_proc;
+    new_proc->rt_period = 0;
+    new_proc->missed_deadlines = 0;
     new_proc->first_port = NULL;
+    new_proc->pending_ports = NULL;
+    new_proc->prev_timeout = NULL;
+    new_proc->next_timeout = NULL;
     new_proc->name = name;
 
-    new_port = create_new_port(new_proc);
+    create_new_port(new_proc);
+
+    stack_size = (stack_size + 3) & ~3;
+    new_proc->stack_size = stack_size;
+    if (new_proc >= pcb && new_proc < pcb + MAX_PROCS
+        && stack_size == DEFAULT_STACK_SIZE) {
+        new_proc->stack_base = 0;
+    } else {
+        new_proc->stack_base = (MEM_ADDR) malloc(stack_size);
+        if (new_proc->stack_base == 0)
+            panic("create(): Out of memory for stack");
+    }
+    return new_proc;
+}
+
+
+/* 
+ * Like create_process(), but the new process gets a stack of stack_size
+ * bytes.
+ */
+PORT create_process_with_stack(void (*ptr_to_new_proc) (PROCESS, PARAM),
+                               int prio, PARAM param, char *name,
+                               int stack_size)
+{
+    MEM_ADDR        esp;
+    PROCESS         new_proc;
+
+    new_proc = new_process(prio, name, stack_size);
 
     /* Compute linear address of new process' system stack */
-    esp = 640 * 1024 - (new_proc - pcb) * 16 * 1024;
+    esp = stack_top(new_proc);
 
 #define PUSH(x)    esp -= 4; \
                    poke_l (esp, (LONG) x);
@@ -60,17 +171,154 @@ PORT create_process(void (*ptr_to_new_proc) (PROCESS, PARAM),
 
     /* Save context ptr (actually current stack pointer) */
     new_proc->esp = esp;
+    new_proc->context = CONTEXT_IRET;
 
     add_ready_queue(new_proc);
 
-    return new_port;
+    return new_proc->first_port;
+}
+
+
+/* 
+ * add_zombie
+ *----------------------------------------------------------------------------
+ * Called by become_zombie() for the exiting process proc. proc is still
+ * running on its stack, so it can only be reclaimed after the next
+ * context switch. Zombies are linked through next_zombie, because
+ * select_process() still follows proc->next for round robin.
+ */
+
+void add_zombie(PROCESS proc)
+{
+    proc->next_zombie = zombie_list;
+    zombie_list = proc;
 }
 
 
-PROCESS fork()
+/* 
+ * reap_zombies
+ *----------------------------------------------------------------------------
+ * Returns the PCB's and stacks of all zombies to the free lists. Must
+ * not be called by a zombie, nor with interrupts disabled since free()
+ * may block.
+ */
+
+void reap_zombies()
 {
-    // Dummy return to make gcc happy
-    return (PROCESS) NULL;
+    PROCESS         proc;
+    PROCESS         zombies;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    zombies = zombie_list;
+    zombie_list = NULL;
+    ENABLE_INTR(flag);
+    while ((proc = zombies) != NULL) {
+        zombies = proc->next_zombie;
+        if (proc == pcb)
+            /* The boot process runs on the stack of the boot loader */
+            continue;
+        if (proc->stack_base != 0)
+            free((void *) proc->stack_base);
+        DISABLE_INTR(flag);
+        proc->magic = 0;
+        proc->used = FALSE;
+        proc->next = next_free_pcb;
+        next_free_pcb = proc;
+        ENABLE_INTR(flag);
+    }
+}
+
+
+/* 
+ * wait
+ *----------------------------------------------------------------------------
+ * Blocks until child, which must have been created by the calling
+ * process, has exited. Returns immediately if child is gone already.
+ * The PCB of an exited child is reused, so a process must not wait for
+ * a child that may have exited before the process created another one.
+ */
+
+void wait(PROCESS child)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (child->used && child->parent == active_proc
+        && child->state != STATE_ZOMBIE) {
+        remove_ready_queue(active_proc);
+        active_proc->param_proc = child;
+        active_proc->state = STATE_WAIT_BLOCKED;
+        resign();
+    }
+    ENABLE_INTR(flag);
+    reap_zombies();
+}
+
+
+/* 
+ * fork_impl
+ *----------------------------------------------------------------------------
+ * Called by fork() in startup.s, which pushed EBP, EBX, ESI and EDI of
+ * the caller; frame points to the saved EDI. Creates a child with its
+ * own port and a copy of the live part of the caller's stack, from frame
+ * up to the top. The child resumes in fork_child (startup.s), which
+ * returns NULL from fork(). The copy is not relocated: the kernel is
+ * built with -fomit-frame-pointer, so there is no chain of frame
+ * pointers to follow, and any pointer into the stack, including a
+ * saved EBP, still refers to the parent's stack. Callers must not use
+ * such pointers in the child.
+ */
+
+PROCESS fork_impl(MEM_ADDR frame)
+{
+    PROCESS         child;
+    MEM_ADDR        top;
+    MEM_ADDR        child_frame;
+    MEM_ADDR        esp;
+    int             live;
+    int             prio;
+
+    /* Real-time parameters are not inherited */
+    prio = active_proc->base_priority;
+    if (prio == RT_PRIORITY)
+        prio = RT_PRIORITY - 1;
+    child = new_process(prio, active_proc->name, active_proc->stack_size);
+
+    top = stack_top(active_proc);
+    live = top - frame;
+    /* Room for the copy plus the context that resign() restores */
+    if (live + 10 * 4 > child->stack_size)
+        panic("fork(): Stack too deep");
+    child_frame = stack_top(child) - live;
+    k_memcpy((void *) child_frame, (void *) frame, live);
+
+    esp = child_frame;
+
+#define PUSH(x)    esp -= 4; \
+                   poke_l (esp, (LONG) x);
+
+    if (interrupts_initialized) {
+        PUSH(512);              /* Flags with enabled Interrupts */
+    } else {
+        PUSH(0);                /* Flags with disabled Interrupts */
+    }
+    PUSH(CODE_SELECTOR);        /* Kernel code selector */
+    PUSH(fork_child);           /* Return to fork() with NULL */
+    PUSH(0);                    /* EAX */
+    PUSH(0);                    /* ECX */
+    PUSH(0);                    /* EDX */
+    PUSH(0);                    /* EBX */
+    PUSH(0);                    /* EBP */
+    PUSH(0);                    /* ESI */
+    PUSH(0);                    /* EDI */
+
+#undef PUSH
+
+    child->esp = esp;
+    child->context = CONTEXT_IRET;
+    add_ready_queue(child);
+    return child;
 }
 
 
@@ -89,7 +337,12 @@ void print_process_details(WINDOW * wnd, PROCESS p)
         "REPLY_BLOCKED  ",
         "RECEIVE_BLOCKED",
         "MESSAGE_BLOCKED",
-        "INTR_BLOCKED   "
+        "INTR_BLOCKED   ",
+        "SLEEPING       ",
+        "WAIT_BLOCKED   ",
+        "MUTEX_BLOCKED  ",
+        "SEM_BLOCKED    ",
+        "COND_BLOCKED   "
     };
     if (!p->used) {
         wprintf(wnd, "PCB slot unused!\n");
@@ -116,15 +369,33 @@ void print_process(WINDOW * wnd, PROCESS p)
 
 void print_all_processes(WINDOW * wnd)
 {
-    int             i;
-    PCB            *p = pcb;
+    PROCESS         p;
 
     print_process_heading(wnd);
-    for (i = 0; i < MAX_PROCS; i++, p++) {
-        if (!p->used)
-            continue;
+    for (p = first_pcb(); p != NULL; p = next_pcb(p))
         print_process_details(wnd, p);
-    }
+}
+
+
+/* 
+ * first_pcb, next_pcb
+ *----------------------------------------------------------------------------
+ * Iterate over all PCB's in use, static or from a slab.
+ */
+
+PROCESS first_pcb()
+{
+    /* The boot process always occupies pcb[0] */
+    return pcb;
+}
+
+
+PROCESS next_pcb(PROCESS p)
+{
+    do
+        p = p->next_slot;
+    while (p != NULL && !p->used);
+    return p;
 }
 
 
@@ -132,26 +403,54 @@ void print_all_processes(WINDOW * wnd)
 void init_process()
 {
     int             i;
+    PROCESS         p;
+
+    init_timeouts();
 
-    /* Clear all PCB's */
-    for (i = 1; i < MAX_PROCS; i++) {
-        pcb[i].magic = 0;
-        pcb[i].used = FALSE;
+    zombie_list = NULL;
+
+    /* Chain the static PCB's in front of the slabs of an earlier run */
+    if (last_slot == NULL) {
+        last_slot = &pcb[MAX_PROCS - 1];
+        last_slot->next_slot = NULL;
     }
+    for (i = 0; i < MAX_PROCS - 1; i++)
+        pcb[i].next_slot = &pcb[i + 1];
+
+    /* Processes of an earlier run may still hold mutexes */
+    for (p = pcb; p != NULL; p = p->next_slot)
+        if (p->used)
+            forget_mutexes(p);
 
-    /* Create free list; don't bother about the first entry, it'll be used 
-     * for the boot process. */
-    for (i = 1; i < MAX_PROCS - 1; i++)
-        pcb[i].next = &pcb[i + 1];
-    pcb[MAX_PROCS - 1].next = NULL;
+    /* Clear all PCB's and create the free list; don't bother about the
+     * first entry, it'll be used for the boot process. */
     next_free_pcb = &pcb[1];
+    for (p = &pcb[1]; p != NULL; p = p->next_slot) {
+        p->magic = 0;
+        p->used = FALSE;
+        p->next = p->next_slot;
+    }
 
     /* Define pcb[0] for this process */
     active_proc = pcb;
     pcb[0].state = STATE_READY;
+    pcb[0].cpu = BOOT_CPU;
+    pcb[0].lock_depth = 0;
     pcb[0].magic = MAGIC_PCB;
     pcb[0].used = TRUE;
     pcb[0].priority = 1;
+    pcb[0].base_priority = 1;
+    pcb[0].waiting_on = NULL;
+    pcb[0].first_client = NULL;
+    pcb[0].held_mutexes = NULL;
+    pcb[0].parent = NULL;
+    pcb[0].stack_base = 0;
+    pcb[0].stack_size = DEFAULT_STACK_SIZE;
+    pcb[0].rt_period = 0;
+    pcb[0].missed_deadlines = 0;
     pcb[0].first_port = NULL;
+    pcb[0].pending_ports = NULL;
+    pcb[0].prev_timeout = NULL;
+    pcb[0].next_timeout = NULL;
     pcb[0].name = "Boot process";
 }
@@ -11,6 +11,7 @@ static int get_line(int window_id, char* buff, int size);
 static int find(const char* buff, int size, char chr);
 static int handle_command(int window_id, const char* buff, char* history[HISTORY_SIZE]);
 static void print_processes(int wnd);
+static void print_irq_stats(int wnd);
 
 // shell process, deals with tokenizing input and forwarding each command to handle_command.
 // each shell has its own history which can be seen via the `history` command.
@@ -121,6 +122,8 @@ int handle_command(int window_id, const char* buff, char* history[HISTORY_SIZE])
 		wm_print(window_id, "shell  Opens another shell instance.\n");
 		wm_print(window_id, "echo [...]  Prints message.\n");
 		wm_print(window_id, "ps  Displays processes.\n");
+		wm_print(window_id, "irq  Displays interrupt counters.\n");
+		wm_print(window_id, "latency [serial|reset]  Longest interrupts-off sections.\n");
 		wm_print(window_id, "history  Shows recent command history.\n");
 		wm_print(window_id, "!<number>  Reexecutes command (see history)\n");
 	} else if (k_memcmp(buff, "clear", sizeof("clear")) == 0) {
@@ -135,6 +138,14 @@ int handle_command(int window_id, const char* buff, char* history[HISTORY_SIZE])
 		wm_print(window_id, "%s\n", buff + sizeof("echo"));
 	} else if (k_memcmp(buff, "ps", sizeof("ps")) == 0) {
 		print_processes(window_id);
+	} else if (k_memcmp(buff, "irq", sizeof("irq")) == 0) {
+		print_irq_stats(window_id);
+	} else if (k_memcmp(buff, "latency", sizeof("latency")) == 0) {
+		print_intr_latency(window_id);
+	} else if (k_memcmp(buff, "latency serial", sizeof("latency serial")) == 0) {
+		dump_intr_latency();
+	} else if (k_memcmp(buff, "latency reset", sizeof("latency reset")) == 0) {
+		reset_intr_latency();
 	} else if (k_memcmp(buff, "history", sizeof("history")) == 0) {
 		for (int idx = 0; idx < HISTORY_SIZE; ++idx) {
 			if (history[idx]) {
@@ -185,7 +196,12 @@ static void print_process_details(int wnd, PROCESS p)
         "REPLY_BLOCKED  ",
         "RECEIVE_BLOCKED",
         "MESSAGE_BLOCKED",
-        "INTR_BLOCKED   "
+        "INTR_BLOCKED   ",
+        "SLEEPING       ",
+        "WAIT_BLOCKED   ",
+        "MUTEX_BLOCKED  ",
+        "SEM_BLOCKED    ",
+        "COND_BLOCKED   "
     };
     if (!p->used) {
         wm_print(wnd, "PCB slot unused!\n");
@@ -207,13 +223,24 @@ static void print_process_details(int wnd, PROCESS p)
 // credit: Arno Puder (from process.c), altered to accept a window id.
 void print_processes(int wnd)
 {
-    int             i;
-    PCB            *p = pcb;
+    PROCESS         p;
 
     print_process_heading(wnd);
-    for (i = 0; i < MAX_PROCS; i++, p++) {
-        if (!p->used)
-            continue;
+    for (p = first_pcb(); p != NULL; p = next_pcb(p))
         print_process_details(wnd, p);
-    }
+}
+
+// lists the counters of every IRQ line that saw any activity.
+void print_irq_stats(int wnd)
+{
+    int             i;
+
+    wm_print(wnd, "IRQ  Delivered  Coalesced       Lost\n");
+    wm_print(wnd, "------------------------------------\n");
+    for (i = 0; i < NUM_IRQS; i++)
+        if (irq_stats[i].delivered || irq_stats[i].coalesced ||
+            irq_stats[i].lost)
+            wm_print(wnd, "%3d %10d %10d %10d\n", i,
+                     irq_stats[i].delivered, irq_stats[i].coalesced,
+                     irq_stats[i].lost);
 }
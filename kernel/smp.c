@@ -0,0 +1,301 @@
+#include <kernel.h>
+
+
+/*
+ * Spinlocks. xchg is atomic without a lock prefix; waiters spin on a
+ * plain read so the cache line is not bounced between CPUs.
+ */
+void spin_lock(SPINLOCK * lock)
+{
+    unsigned        locked;
+
+    while (1) {
+        locked = 1;
+        asm volatile ("xchgl %0,%1":"+r" (locked), "+m"(*lock)::"memory");
+        if (locked == 0)
+            return;
+        while (*lock != 0)
+            asm volatile ("rep; nop");
+    }
+}
+
+
+void spin_unlock(SPINLOCK * lock)
+{
+    asm volatile ("":::"memory");
+    *lock = 0;
+}
+
+
+#ifdef SMP
+
+/*
+ * Symmetric multiprocessing. All CPUs share the ready queues; a single
+ * kernel lock, taken by DISABLE_INTR(), serializes the kernel. Device
+ * IRQs are handled by the boot CPU, the application processors (APs)
+ * only get the tick of their local APIC timer. An idle CPU picks up
+ * ready processes at its next tick.
+ */
+
+CPU             cpus[MAX_CPUS];
+int             num_cpus;
+
+static SPINLOCK kernel_lock;
+
+/* Flat code and data segments, then one data segment per CPU for %gs */
+#define GDT_ENTRIES     (CPU_SELECTOR(MAX_CPUS) / 8)
+
+static unsigned gdt[2 * GDT_ENTRIES];
+
+/* Used by ap_entry to hand out the boot stacks */
+volatile int    ap_arrivals;
+char            ap_stacks[MAX_CPUS - 1][AP_BOOT_STACK_SIZE];
+
+/* Interrupt command register: all CPUs but the sender */
+#define ICR_INIT                0x000C4500
+#define ICR_STARTUP             0x000C4600
+
+#define STR(x)          #x
+#define XSTR(x)         STR(x)
+
+/*
+ * The APs start in real mode at AP_TRAMPOLINE, where start_aps() copies
+ * this code. It loads the kernel GDT (ap_gdtr is filled in by
+ * start_aps()), enters protected mode and jumps to ap_entry, which
+ * gives each AP its own boot stack. Everything up to ap_trampoline_end
+ * must be position independent.
+ */
+asm(".text\n"
+    ".globl ap_trampoline\n"
+    ".globl ap_gdtr\n"
+    ".globl ap_trampoline_end\n"
+    ".code16\n"
+    "ap_trampoline:\n"
+    "	cli\n"
+    "	movw %cs,%ax\n"
+    "	movw %ax,%ds\n"
+    "	lgdtl ap_gdtr - ap_trampoline\n"
+    "	movl %cr0,%eax\n"
+    "	orl $1,%eax\n"
+    "	movl %eax,%cr0\n"
+    "	ljmpl $" XSTR(CODE_SELECTOR) ",$(" XSTR(AP_TRAMPOLINE)
+    " + ap_trampoline_32 - ap_trampoline)\n"
+    ".code32\n"
+    "ap_trampoline_32:\n"
+    "	movw $" XSTR(DATA_SELECTOR) ",%ax\n"
+    "	movw %ax,%ds\n"
+    "	movw %ax,%es\n"
+    "	movw %ax,%fs\n"
+    "	movw %ax,%gs\n"
+    "	movw %ax,%ss\n"
+    "	movl $ap_entry,%eax\n"
+    "	jmp *%eax\n"
+    "ap_gdtr:\n"
+    "	.word 0\n"
+    "	.long 0\n"
+    "ap_trampoline_end:\n"
+    "\n"
+    "ap_entry:\n"
+    "	movl $1,%eax\n"
+    "	lock xaddl %eax,ap_arrivals\n"
+    "	cmpl $" XSTR(MAX_CPUS - 1) ",%eax\n"
+    "	jae ap_halt\n"
+    "	leal 1(%eax),%esp\n"
+    "	imull $" XSTR(AP_BOOT_STACK_SIZE) ",%esp\n"
+    "	addl $ap_stacks,%esp\n"
+    "	pushl %eax\n"
+    "	call ap_main\n"
+    "ap_halt:\n"
+    "	cli\n"
+    "	hlt\n"
+    "	jmp ap_halt\n");
+
+extern char     ap_trampoline[];
+extern char     ap_gdtr[];
+extern char     ap_trampoline_end[];
+
+
+void set_gdt_entry(int n, unsigned base, unsigned access)
+{
+    /* 4 GB limit, page granular, 32 bit */
+    gdt[2 * n] = 0xffff | (base << 16);
+    gdt[2 * n + 1] = ((base >> 16) & 0xff) | (access << 8) | 0xcf0000 |
+        (base & 0xff000000);
+}
+
+
+void load_gdt()
+{
+    volatile unsigned char mem48[6];
+
+    *((volatile unsigned short *) &mem48[0]) = sizeof(gdt) - 1;
+    *((volatile unsigned *) &mem48[2]) = (unsigned) gdt;
+    asm volatile ("lgdt %0"::"m" (mem48));
+}
+
+
+/*
+ * Points %gs of the calling CPU at cpus[cpu].
+ */
+void load_cpu_segment(int cpu)
+{
+    asm volatile ("movw %w0,%%gs"::"r" (CPU_SELECTOR(cpu)));
+}
+
+
+/*
+ * lock_kernel
+ *----------------------------------------------------------------------------
+ * Takes the kernel lock. The lock is recursive per CPU; the depth of a
+ * process that switches away is saved in its PCB. Interrupts must be
+ * disabled.
+ */
+
+void lock_kernel()
+{
+    CPU            *cpu = this_cpu();
+
+    if (cpu->lock_depth++ == 0)
+        spin_lock(&kernel_lock);
+}
+
+
+void unlock_kernel()
+{
+    CPU            *cpu = this_cpu();
+
+    assert(cpu->lock_depth > 0);
+    if (--cpu->lock_depth == 0)
+        spin_unlock(&kernel_lock);
+}
+
+
+/*
+ * ap_main
+ *----------------------------------------------------------------------------
+ * First C code run by an AP, on its boot stack. slot is the order of
+ * arrival. Waits until start_aps() created the idle process of the CPU
+ * and resumes it, which leaves the boot stack for good. The AP has no
+ * process of its own before, so it must not call anything that may
+ * block, such as malloc().
+ */
+
+void ap_main(int slot)
+{
+    CPU            *cpu;
+
+    load_cpu_segment(slot + 1);
+    load_idt(idt);
+    init_ap_apic();
+    cpu = this_cpu();
+    while (*((PROCESS volatile *) &cpu->idle) == NULL)
+        asm volatile ("rep; nop");
+    lock_kernel();
+    active_proc = cpu->idle;
+    resume_active_proc();
+}
+
+
+/*
+ * init_smp
+ *----------------------------------------------------------------------------
+ * Sets up the per-CPU data and the GDT and makes the calling CPU the
+ * boot CPU. Must run before anything touches active_proc.
+ */
+
+void init_smp()
+{
+    int             i;
+
+    set_gdt_entry(CODE_SELECTOR / 8, 0, 0x9a);
+    set_gdt_entry(DATA_SELECTOR / 8, 0, 0x92);
+    for (i = 0; i < MAX_CPUS; i++) {
+        cpus[i].self = &cpus[i];
+        cpus[i].index = i;
+        cpus[i].current = NULL;
+        cpus[i].idle = NULL;
+        cpus[i].interrupted = NULL;
+        cpus[i].irq_nesting = 0;
+        cpus[i].lock_depth = 0;
+        set_gdt_entry(CPU_SELECTOR(i) / 8, (unsigned) &cpus[i], 0x92);
+    }
+    kernel_lock = SPINLOCK_INIT;
+    num_cpus = 1;
+    ap_arrivals = 0;
+    load_gdt();
+    load_cpu_segment(BOOT_CPU);
+}
+
+
+/*
+ * start_aps
+ *----------------------------------------------------------------------------
+ * Wakes up the APs with the INIT-SIPI-SIPI sequence. Without ACPI or MP
+ * tables the IPIs are broadcast; every AP that answers within 100 ms,
+ * up to MAX_CPUS - 1, gets an idle process and is counted in num_cpus.
+ * The APs rely on their local APIC timer to look for work, so they stay
+ * asleep if the APIC timer is not the tick source.
+ */
+
+void start_aps()
+{
+    unsigned char  *gdtr;
+    PORT            port;
+    int             arrived;
+    int             i;
+    volatile int    flag;
+
+    if (!apic_timer_active)
+        return;
+
+    k_memcpy((void *) AP_TRAMPOLINE, ap_trampoline,
+             ap_trampoline_end - ap_trampoline);
+    gdtr = (unsigned char *) AP_TRAMPOLINE + (ap_gdtr - ap_trampoline);
+    *((unsigned short *) &gdtr[0]) = sizeof(gdt) - 1;
+    *((unsigned *) &gdtr[2]) = (unsigned) gdt;
+
+    apic_send_ipi(ICR_INIT);
+    pit_delay(PIT_FREQUENCY / 100);
+    for (i = 0; i < 2; i++) {
+        apic_send_ipi(ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+        pit_delay(PIT_FREQUENCY / 5000);
+    }
+    for (i = 0; i < 10; i++)
+        pit_delay(PIT_FREQUENCY / 100);
+
+    arrived = ap_arrivals;
+    if (arrived > MAX_CPUS - 1)
+        arrived = MAX_CPUS - 1;
+    for (i = 1; i <= arrived; i++) {
+        port = create_process(null_process, 0, 0, "Idle process");
+        DISABLE_INTR(flag);
+        remove_ready_queue(port->owner);
+        cpus[i].idle = port->owner;
+        num_cpus++;
+        ENABLE_INTR(flag);
+    }
+}
+
+#endif
+
+
+/*
+ * finish_switch
+ *----------------------------------------------------------------------------
+ * Called by switch_stack() on the stack of the new active_proc if
+ * CONTEXT_FINISH is set. Marks active_proc as running on this CPU and
+ * restores its kernel lock depth, releasing the lock if it is 0. Only
+ * now may another CPU pick up the previous process.
+ */
+
+void finish_switch()
+{
+#ifdef SMP
+    CPU            *cpu = this_cpu();
+
+    active_proc->cpu = cpu->index;
+    cpu->lock_depth = active_proc->lock_depth;
+    if (cpu->lock_depth == 0)
+        spin_unlock(&kernel_lock);
+#endif
+}
@@ -16,3 +16,153 @@ start:
 	call kernel_main
 L1:
 	jmp L1
+
+
+/*
+ * PROCESS fork()
+ *
+ * Saves the callee-saved registers of the caller on the stack and lets
+ * fork_impl() clone the stack from there. The parent returns the child,
+ * the child resumes at fork_child and returns NULL.
+ */
+.globl fork
+.globl fork_child
+
+fork:
+	pushl %ebp
+	pushl %ebx
+	pushl %esi
+	pushl %edi
+	pushl %esp
+	call fork_impl
+	addl $4,%esp
+	jmp fork_return
+fork_child:
+	xorl %eax,%eax
+fork_return:
+	popl %edi
+	popl %esi
+	popl %ebx
+	popl %ebp
+	ret
+
+
+/*
+ * void fiber_switch(MEM_ADDR* save_esp, MEM_ADDR new_esp)
+ *
+ * Saves the callee-saved registers of the caller on its stack, stores
+ * the stack pointer in *save_esp and resumes the context saved at
+ * new_esp. Interrupt flags are left alone.
+ */
+.globl fiber_switch
+
+fiber_switch:
+	movl 4(%esp),%eax
+	movl 8(%esp),%edx
+	pushl %ebp
+	pushl %ebx
+	pushl %esi
+	pushl %edi
+	movl %esp,(%eax)
+	movl %edx,%esp
+	popl %edi
+	popl %esi
+	popl %ebx
+	popl %ebp
+	ret
+
+
+/*
+ * void switch_stack(MEM_ADDR* save_esp, MEM_ADDR new_esp,
+ *                   unsigned new_context)
+ *
+ * Saves the callee-saved registers of the caller, stores the stack
+ * pointer in *save_esp and resumes the context at new_esp. A
+ * CONTEXT_SWITCH context is another switch_stack() frame, a CONTEXT_IRET
+ * context is the full interrupt frame built by an ISR or by
+ * create_process(). With CONTEXT_FINISH or'ed to new_context,
+ * finish_switch() runs on the new stack before the context is restored.
+ */
+.globl switch_stack
+
+switch_stack:
+	movl 4(%esp),%eax
+	movl 8(%esp),%edx
+	movl 12(%esp),%ecx
+	pushl %ebp
+	pushl %ebx
+	pushl %esi
+	pushl %edi
+	movl %esp,(%eax)
+	movl %edx,%esp
+	testl $2,%ecx
+	jz 1f
+	pushl %ecx
+	call finish_switch
+	popl %ecx
+1:	testl $1,%ecx
+	jz resume_iret
+	popl %edi
+	popl %esi
+	popl %ebx
+	popl %ebp
+	ret
+resume_iret:
+	popl %edi
+	popl %esi
+	popl %ebp
+	popl %ebx
+	popl %edx
+	popl %ecx
+	popl %eax
+	iret
+
+
+/*
+ * Entry stubs for the 16 PIC lines. Each one saves the context like the
+ * other ISRs and passes its IRQ number and the saved context to
+ * irq_dispatch(), which never returns.
+ */
+.macro IRQ_STUB irq
+irq_stub_\irq:
+	pushl %eax
+	pushl %ecx
+	pushl %edx
+	pushl %ebx
+	pushl %ebp
+	pushl %esi
+	pushl %edi
+	movl $\irq,%eax
+	jmp irq_common
+.endm
+
+	IRQ_STUB 0
+	IRQ_STUB 1
+	IRQ_STUB 2
+	IRQ_STUB 3
+	IRQ_STUB 4
+	IRQ_STUB 5
+	IRQ_STUB 6
+	IRQ_STUB 7
+	IRQ_STUB 8
+	IRQ_STUB 9
+	IRQ_STUB 10
+	IRQ_STUB 11
+	IRQ_STUB 12
+	IRQ_STUB 13
+	IRQ_STUB 14
+	IRQ_STUB 15
+
+irq_common:
+	pushl %esp
+	pushl %eax
+	call irq_dispatch
+
+.globl irq_stubs
+
+	.align 4
+irq_stubs:
+	.long irq_stub_0, irq_stub_1, irq_stub_2, irq_stub_3
+	.long irq_stub_4, irq_stub_5, irq_stub_6, irq_stub_7
+	.long irq_stub_8, irq_stub_9, irq_stub_10, irq_stub_11
+	.long irq_stub_12, irq_stub_13, irq_stub_14, irq_stub_15
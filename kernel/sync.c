@@ -0,0 +1,358 @@
+#include <kernel.h>
+
+
+/*
+ * Blocking synchronization between processes. Only the bookkeeping runs
+ * with interrupts disabled; a process waiting for a mutex, semaphore or
+ * condition variable is off the ready queue like any other blocked
+ * process. None of these may be used by interrupt handlers or tasklets.
+ *
+ * A process blocked on a mutex lends its priority to the owner, just
+ * like a client lends its priority to a server (see ipc.c).
+ */
+
+
+static void append_waiter(WAIT_LIST * list, PROCESS proc)
+{
+    proc->next_blocked = NULL;
+    if (list->tail == NULL)
+        list->head = proc;
+    else
+        list->tail->next_blocked = proc;
+    list->tail = proc;
+}
+
+
+static PROCESS remove_first_waiter(WAIT_LIST * list)
+{
+    PROCESS         proc = list->head;
+
+    if (proc != NULL) {
+        list->head = proc->next_blocked;
+        if (list->head == NULL)
+            list->tail = NULL;
+        proc->next_blocked = NULL;
+    }
+    return proc;
+}
+
+
+/*
+ * Takes active_proc off the ready queue and waits on list until another
+ * process makes it ready again. Interrupts must be disabled.
+ */
+static void block_on(WAIT_LIST * list, int state)
+{
+    append_waiter(list, active_proc);
+    remove_ready_queue(active_proc);
+    active_proc->state = state;
+    resign();
+}
+
+
+static void init_wait_list(WAIT_LIST * list)
+{
+    list->head = NULL;
+    list->tail = NULL;
+}
+
+
+
+/*
+ * init_mutex
+ *----------------------------------------------------------------------------
+ * Initializes an unlocked mutex. Static mutexes may use MUTEX_INIT
+ * instead.
+ */
+
+void init_mutex(MUTEX * mutex)
+{
+    mutex->owner = NULL;
+    init_wait_list(&mutex->waiting);
+    mutex->next_held = NULL;
+}
+
+
+/*
+ * Makes proc the owner of the unlocked mutex.
+ */
+static void take_mutex(MUTEX * mutex, PROCESS proc)
+{
+    mutex->owner = proc;
+    mutex->next_held = proc->held_mutexes;
+    proc->held_mutexes = mutex;
+}
+
+
+/*
+ * Passes the mutex owned by owner to the first waiter, or unlocks it if
+ * there is none. Returns the new owner, which is ready but has not been
+ * switched to.
+ */
+static PROCESS hand_over_mutex(PROCESS owner, MUTEX * mutex)
+{
+    MUTEX         **link = &owner->held_mutexes;
+    PROCESS         next;
+    PROCESS         p;
+
+    assert(mutex->owner == owner);
+    while (*link != mutex) {
+        assert(*link != NULL);
+        link = &(*link)->next_held;
+    }
+    *link = mutex->next_held;
+    mutex->next_held = NULL;
+    mutex->owner = NULL;
+
+    next = remove_first_waiter(&mutex->waiting);
+    if (next != NULL) {
+        next->waiting_on = NULL;
+        take_mutex(mutex, next);
+        /* The remaining waiters now lend their priority to next */
+        for (p = mutex->waiting.head; p != NULL; p = p->next_blocked)
+            p->waiting_on = next;
+        update_priority(next);
+        add_ready_queue(next);
+    }
+    return next;
+}
+
+
+/*
+ * Like hand_over_mutex() for a mutex owned by active_proc, which gets
+ * back its own priority.
+ */
+static PROCESS release_mutex(MUTEX * mutex)
+{
+    PROCESS         next;
+
+    next = hand_over_mutex(active_proc, mutex);
+    /* Give back what the waiters lent */
+    update_priority(active_proc);
+    return next;
+}
+
+
+/*
+ * mutex_lock
+ *----------------------------------------------------------------------------
+ * Locks mutex, blocking while another process owns it. Mutexes are not
+ * recursive. Waiters get the mutex in FIFO order.
+ */
+
+void mutex_lock(MUTEX * mutex)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (mutex->owner == NULL)
+        take_mutex(mutex, active_proc);
+    else {
+        assert(mutex->owner != active_proc);
+        active_proc->waiting_on = mutex->owner;
+        inherit_priority(mutex->owner, active_proc->priority);
+        block_on(&mutex->waiting, STATE_MUTEX_BLOCKED);
+        /* release_mutex() made us the owner */
+        assert(mutex->owner == active_proc);
+    }
+    ENABLE_INTR(flag);
+}
+
+
+/*
+ * mutex_trylock
+ *----------------------------------------------------------------------------
+ * Locks mutex if it is unlocked. Returns FALSE instead of blocking.
+ */
+
+BOOL mutex_trylock(MUTEX * mutex)
+{
+    BOOL            locked = FALSE;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (mutex->owner == NULL) {
+        take_mutex(mutex, active_proc);
+        locked = TRUE;
+    }
+    ENABLE_INTR(flag);
+    return locked;
+}
+
+
+/*
+ * mutex_unlock
+ *----------------------------------------------------------------------------
+ * Unlocks mutex, which the caller must own. If a process with a higher
+ * priority was waiting for it, that process runs right away.
+ */
+
+void mutex_unlock(MUTEX * mutex)
+{
+    PROCESS         next;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    next = release_mutex(mutex);
+    if (next != NULL && next->priority > active_proc->priority)
+        resign();
+    ENABLE_INTR(flag);
+}
+
+
+
+/*
+ * abandon_mutexes
+ *----------------------------------------------------------------------------
+ * Called by become_zombie() for the exiting process proc. Each mutex
+ * proc still holds goes to its first waiter, which also stops lending
+ * its priority to proc. Interrupts must be disabled.
+ */
+
+void abandon_mutexes(PROCESS proc)
+{
+    while (proc->held_mutexes != NULL)
+        hand_over_mutex(proc, proc->held_mutexes);
+}
+
+
+/*
+ * forget_mutexes
+ *----------------------------------------------------------------------------
+ * Unlocks all mutexes held by proc and forgets their waiters. Only for
+ * init_process(), which discards all processes at once.
+ */
+
+void forget_mutexes(PROCESS proc)
+{
+    MUTEX          *mutex;
+
+    while ((mutex = proc->held_mutexes) != NULL) {
+        proc->held_mutexes = mutex->next_held;
+        init_mutex(mutex);
+    }
+}
+
+
+
+/*
+ * init_semaphore
+ *----------------------------------------------------------------------------
+ * Initializes a counting semaphore with count available units.
+ */
+
+void init_semaphore(SEMAPHORE * sem, int count)
+{
+    assert(count >= 0);
+    sem->count = count;
+    init_wait_list(&sem->waiting);
+}
+
+
+/*
+ * semaphore_wait
+ *----------------------------------------------------------------------------
+ * Takes one unit, blocking until one is available.
+ */
+
+void semaphore_wait(SEMAPHORE * sem)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (sem->count > 0)
+        sem->count--;
+    else
+        /* semaphore_signal() passes its unit on to us */
+        block_on(&sem->waiting, STATE_SEM_BLOCKED);
+    ENABLE_INTR(flag);
+}
+
+
+/*
+ * semaphore_signal
+ *----------------------------------------------------------------------------
+ * Returns one unit. It goes straight to the first waiter, if any.
+ */
+
+void semaphore_signal(SEMAPHORE * sem)
+{
+    PROCESS         next;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    next = remove_first_waiter(&sem->waiting);
+    if (next == NULL)
+        sem->count++;
+    else {
+        add_ready_queue(next);
+        if (next->priority > active_proc->priority)
+            resign();
+    }
+    ENABLE_INTR(flag);
+}
+
+
+
+void init_condition(CONDITION * cond)
+{
+    init_wait_list(&cond->waiting);
+}
+
+
+/*
+ * condition_wait
+ *----------------------------------------------------------------------------
+ * Atomically unlocks mutex and waits for cond to be signalled, then
+ * locks mutex again. As usual, the caller has to recheck its predicate.
+ */
+
+void condition_wait(CONDITION * cond, MUTEX * mutex)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    release_mutex(mutex);
+    block_on(&cond->waiting, STATE_COND_BLOCKED);
+    ENABLE_INTR(flag);
+    mutex_lock(mutex);
+}
+
+
+/*
+ * condition_signal
+ *----------------------------------------------------------------------------
+ * Wakes up the first process waiting on cond, if any. It runs once it
+ * gets the mutex, so the caller normally holds the mutex while
+ * signalling.
+ */
+
+void condition_signal(CONDITION * cond)
+{
+    PROCESS         proc;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    proc = remove_first_waiter(&cond->waiting);
+    if (proc != NULL)
+        add_ready_queue(proc);
+    ENABLE_INTR(flag);
+}
+
+
+/*
+ * condition_broadcast
+ *----------------------------------------------------------------------------
+ * Wakes up all processes waiting on cond.
+ */
+
+void condition_broadcast(CONDITION * cond)
+{
+    PROCESS         proc;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    while ((proc = remove_first_waiter(&cond->waiting)) != NULL)
+        add_ready_queue(proc);
+    ENABLE_INTR(flag);
+}
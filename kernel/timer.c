@@ -1,46 +1,451 @@
-
 #include <kernel.h>
 
 
 PORT            timer_port;
 
-void timer_notifier(PROCESS self, PARAM param)
+/* 
+ * Delta list of all processes that wait for a number of timer ticks,
+ * sorted by expiry. proc->timeout holds the number of ticks between
+ * proc and its predecessor on the list, so only the head needs to be
+ * touched on a timer tick.
+ */
+PROCESS         timeout_list = NULL;
+
+
+BOOL timeout_armed(PROCESS proc)
 {
-    while (42) {
-        wait_for_interrupt(TIMER_IRQ);
-        message(timer_port, 0);
+    return proc == timeout_list || proc->prev_timeout != NULL;
+}
+
+
+/* 
+ * add_timeout
+ *----------------------------------------------------------------------------
+ * Arms a timeout of ticks timer ticks for proc, which is about to block.
+ * If proc is still blocked when the timeout expires, it is made ready
+ * again with proc->wake_reason set to WAKE_TIMEOUT.
+ */
+
+void add_timeout(PROCESS proc, int ticks)
+{
+    PROCESS         prev;
+    PROCESS         next;
+    volatile int    flag;
+
+    assert(ticks > 0);
+    DISABLE_INTR(flag);
+    assert(!timeout_armed(proc));
+    proc->wake_reason = WAKE_NORMAL;
+    prev = NULL;
+    next = timeout_list;
+    while (next != NULL && next->timeout <= ticks) {
+        ticks -= next->timeout;
+        prev = next;
+        next = next->next_timeout;
     }
-    become_zombie();
+    proc->timeout = ticks;
+    proc->prev_timeout = prev;
+    proc->next_timeout = next;
+    if (prev == NULL)
+        timeout_list = proc;
+    else
+        prev->next_timeout = proc;
+    if (next != NULL) {
+        next->prev_timeout = proc;
+        next->timeout -= ticks;
+    }
+    ENABLE_INTR(flag);
+}
+
+
+void unlink_timeout(PROCESS proc)
+{
+    if (proc->prev_timeout == NULL)
+        timeout_list = proc->next_timeout;
+    else
+        proc->prev_timeout->next_timeout = proc->next_timeout;
+    if (proc->next_timeout != NULL) {
+        proc->next_timeout->prev_timeout = proc->prev_timeout;
+        proc->next_timeout->timeout += proc->timeout;
+    }
+    proc->prev_timeout = NULL;
+    proc->next_timeout = NULL;
+}
+
+
+/* 
+ * cancel_timeout
+ *----------------------------------------------------------------------------
+ * Disarms the timeout of proc, if any.
+ */
+
+void cancel_timeout(PROCESS proc)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    if (timeout_armed(proc))
+        unlink_timeout(proc);
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * expire_timeout
+ *----------------------------------------------------------------------------
+ * Wakes up proc if it is still blocked in the operation that armed the
+ * timeout. Otherwise the wakeup already happened and nothing is done.
+ */
+
+void expire_timeout(PROCESS proc)
+{
+    switch (proc->state) {
+    case STATE_SEND_BLOCKED:
+        remove_from_send_blocked_list(proc->blocked_port, proc);
+        break;
+    case STATE_RECEIVE_BLOCKED:
+        proc->param_proc = NULL;
+        proc->param_data = NULL;
+        break;
+    case STATE_INTR_BLOCKED:
+    case STATE_SLEEPING:
+        break;
+    default:
+        return;
+    }
+    proc->wake_reason = WAKE_TIMEOUT;
+    add_ready_queue(proc);
+}
+
+
+/* 
+ * check_timeouts
+ *----------------------------------------------------------------------------
+ * Called by the timer ISR after ticks timer ticks passed; usually ticks
+ * is 1. Wakes up all processes whose timeout expired; the cost is
+ * proportional to the number of expired timeouts.
+ */
+
+void check_timeouts(int ticks)
+{
+    PROCESS         proc;
+
+    while ((proc = timeout_list) != NULL) {
+        if (proc->timeout > ticks) {
+            proc->timeout -= ticks;
+            return;
+        }
+        ticks -= proc->timeout;
+        proc->timeout = 0;
+        unlink_timeout(proc);
+        expire_timeout(proc);
+    }
+}
+
+
+/* 
+ * sleep_ticks
+ *----------------------------------------------------------------------------
+ * Puts proc, which must not be on the ready queue, to sleep for ticks
+ * timer ticks.
+ */
+
+void sleep_ticks(PROCESS proc, int ticks)
+{
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    proc->state = STATE_SLEEPING;
+    add_timeout(proc, ticks);
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Number of timer ticks since init_timer(), together with the TSC value
+ * sampled on the last tick. The TSC is calibrated against the PIT over
+ * the first TSC_CALIBRATION_TICKS ticks; until then cycles_per_tick is
+ * 0 and get_time_ns() only has tick resolution.
+ */
+#define TSC_CALIBRATION_TICKS MS_TO_TICKS(100)
+
+volatile unsigned timer_ticks = 0;
+unsigned long long tick_tsc = 0;
+unsigned long long calibration_tsc = 0;
+unsigned        calibration_ticks;
+unsigned        cycles_per_tick = 0;
+
+/* 
+ * State of tickless idle. tickless_ticks is 0 while channel 0 of the PIT
+ * runs as periodic rate generator. Otherwise it runs in one-shot mode
+ * with tickless_count, which ends on the tick boundary tickless_ticks
+ * ticks after the last tick that was accounted for. tickless_offset is
+ * the part of that first tick, in PIT counts, which had already passed
+ * when the one-shot was programmed.
+ */
+#define PIT_MAX_COUNT   65535
+
+BOOL            pit_programmed = FALSE;
+int             tickless_ticks = 0;
+unsigned        tickless_count;
+unsigned        tickless_offset;
+
+
+unsigned long long read_tsc()
+{
+    unsigned long long tsc;
+
+    asm volatile ("rdtsc":"=A" (tsc));
+    return tsc;
+}
+
+
+/* 
+ * Computes a * b / c. The intermediate product has 64 bits; the
+ * quotient must fit into 32 bits.
+ */
+unsigned mul_div(unsigned a, unsigned b, unsigned c)
+{
+    unsigned        q;
+    unsigned        r;
+
+  asm("mull %3\n\tdivl %4": "=a"(q), "=&d"(r):"0"(a), "rm"(b), "rm"(c):"cc");
+    return q;
+}
+
+
+/* 
+ * update_clock
+ *----------------------------------------------------------------------------
+ * Called by the timer ISR on the tick boundary after ticks timer ticks
+ * passed.
+ */
+
+void update_clock(int ticks)
+{
+    tick_tsc = read_tsc();
+    timer_ticks += ticks;
+    if (cycles_per_tick != 0)
+        return;
+    if (calibration_tsc == 0) {
+        calibration_ticks = timer_ticks;
+        calibration_tsc = tick_tsc;
+    } else if (timer_ticks - calibration_ticks >= TSC_CALIBRATION_TICKS)
+        cycles_per_tick = (unsigned) (tick_tsc - calibration_tsc)
+            / (timer_ticks - calibration_ticks);
+}
+
+
+/* 
+ * get_ticks
+ *----------------------------------------------------------------------------
+ * Returns the number of timer ticks since init_timer(). One tick lasts
+ * NS_PER_TICK nanoseconds.
+ */
+
+unsigned get_ticks()
+{
+    return timer_ticks;
+}
+
+
+/* 
+ * get_time_ns
+ *----------------------------------------------------------------------------
+ * Returns a monotonic time stamp in nanoseconds since init_timer(). The
+ * tick count is interpolated with the TSC, giving a resolution well
+ * below one tick once the TSC is calibrated.
+ */
+
+unsigned long long get_time_ns()
+{
+    unsigned        ticks;
+    unsigned long long last_tsc;
+    unsigned long long now;
+    unsigned        delta;
+    unsigned long long ns;
+    volatile int    flag;
+
+    DISABLE_INTR(flag);
+    ticks = timer_ticks;
+    last_tsc = tick_tsc;
+    now = read_tsc();
+    ENABLE_INTR(flag);
+
+    ns = (unsigned long long) ticks * NS_PER_TICK;
+    if (cycles_per_tick != 0) {
+        /* 
+         * A tick may be pending while interrupts are disabled. Never
+         * report a time that lies beyond the next tick.
+         */
+        if (now - last_tsc >= cycles_per_tick)
+            delta = cycles_per_tick - 1;
+        else
+            delta = (unsigned) (now - last_tsc);
+        ns += mul_div(delta, NS_PER_TICK, cycles_per_tick);
+    }
+    return ns;
+}
+
+
+void program_pit(int mode, unsigned count)
+{
+    outportb(0x43, 0x30 | (mode << 1));
+    outportb(0x40, count & 0xff);
+    outportb(0x40, count >> 8);
+}
+
+
+/* 
+ * Returns the number of PIT counts that passed since the last tick that
+ * was accounted for.
+ */
+unsigned pit_counts_since_tick()
+{
+    unsigned        remaining;
+
+    /* Latch the counter of channel 0 */
+    outportb(0x43, 0x00);
+    remaining = inportb(0x40);
+    remaining |= inportb(0x40) << 8;
+    if (tickless_ticks == 0)
+        return PIT_DIVISOR - remaining;
+    return tickless_offset + tickless_count - remaining;
+}
+
+
+/* 
+ * Returns TRUE if the one-shot programmed by start_tickless() reached
+ * its terminal count, i.e. its interrupt is about to be delivered.
+ */
+BOOL pit_fired()
+{
+    /* Read back the status of channel 0. Bit 7 is the OUT pin */
+    outportb(0x43, 0xe2);
+    return (inportb(0x40) & 0x80) != 0;
 }
 
+
+/* 
+ * start_tickless
+ *----------------------------------------------------------------------------
+ * Called by the null process with interrupts disabled when no other
+ * process is ready. Replaces the periodic timer interrupt with a single
+ * one on the tick on which the first timeout expires, bounded by what
+ * the 16 bit counter of the PIT can express.
+ */
+
+void start_tickless()
+{
+    unsigned        elapsed;
+    int             ticks;
+
+    if (!pit_programmed || tickless_ticks != 0)
+        return;
+    /* Somebody waits for every single tick */
+    if (interrupt_table[TIMER_IRQ] != NULL)
+        return;
+    /* A periodic tick is already pending in the PIC */
+    outportb(0x20, 0x0a);
+    if (inportb(0x20) & 1)
+        return;
+    elapsed = pit_counts_since_tick();
+    ticks = (PIT_MAX_COUNT + elapsed) / PIT_DIVISOR;
+    if (timeout_list != NULL && timeout_list->timeout < ticks)
+        ticks = timeout_list->timeout;
+    if (ticks < 2)
+        return;
+    tickless_ticks = ticks;
+    tickless_offset = elapsed;
+    tickless_count = ticks * PIT_DIVISOR - elapsed;
+    program_pit(0, tickless_count);
+}
+
+
+/* 
+ * end_tickless
+ *----------------------------------------------------------------------------
+ * Called by the timer ISR. Returns FALSE if the PIT runs periodically.
+ * Otherwise the one-shot expired: accounts for all ticks it covered and
+ * resumes the periodic timer interrupt.
+ */
+
+BOOL end_tickless()
+{
+    int             ticks = tickless_ticks;
+
+    if (ticks == 0)
+        return FALSE;
+    program_pit(2, PIT_DIVISOR);
+    tickless_ticks = 0;
+    update_clock(ticks);
+    check_timeouts(ticks);
+    return TRUE;
+}
+
+
+/* 
+ * leave_tickless
+ *----------------------------------------------------------------------------
+ * Called by all other ISR's, which may make a process ready before the
+ * one-shot expired. Accounts for the ticks that passed so far and cuts
+ * the one-shot short at the next tick boundary; end_tickless() then
+ * resumes the periodic timer interrupt.
+ */
+
+void leave_tickless()
+{
+    unsigned        elapsed;
+    int             ticks;
+
+    if (tickless_ticks == 0 || pit_fired())
+        return;
+    elapsed = pit_counts_since_tick();
+    if (elapsed > tickless_offset + tickless_count)
+        /* The one-shot fired after all; the counter wrapped around */
+        return;
+    ticks = elapsed / PIT_DIVISOR;
+    elapsed %= PIT_DIVISOR;
+    if (ticks == 0 && tickless_ticks == 1)
+        return;
+    tickless_ticks = 1;
+    tickless_offset = elapsed;
+    tickless_count = PIT_DIVISOR - elapsed;
+    program_pit(0, tickless_count);
+    if (ticks == 0)
+        return;
+    update_clock(ticks);
+    /* update_clock() sampled the TSC in the middle of a tick */
+    if (cycles_per_tick != 0)
+        tick_tsc -= mul_div(elapsed, cycles_per_tick, PIT_DIVISOR);
+    else
+        calibration_tsc = 0;
+    check_timeouts(ticks);
+}
+
+
+/* 
+ * The timer process only serves clients that still send a Timer_Message
+ * to timer_port. The client stays off the ready queue until the timer
+ * ISR wakes it up; no reply is sent. It is no longer a client of the
+ * timer process, which gives back the priority it inherited.
+ */
 void timer_process(PROCESS self, PARAM param)
 {
-    int             ticks_left[MAX_PROCS];
     Timer_Message  *msg;
     PROCESS         sender;
-    int             i;
-
-    for (i = 0; i < MAX_PROCS; i++)
-        ticks_left[i] = 0;
-
-    create_process(timer_notifier, 7, 0, "Timer notifier");
+    volatile int    flag;
 
     while (42) {
         msg = (Timer_Message *) receive(&sender);
-        if (msg == NULL) {
-            // The timer notifier sent us a message
-            for (i = 0; i < MAX_PROCS; i++) {
-                if (ticks_left[i] == 0)
-                    continue;
-                if (--ticks_left[i] == 0) {
-                    // Wake up client
-                    reply(&pcb[i]);
-                }
-            }
-        } else {
-            // A client sent us a message
-            i = sender - pcb;
-            ticks_left[i] = msg->num_of_ticks;
+        if (msg->num_of_ticks <= 0)
+            reply(sender);
+        else {
+            DISABLE_INTR(flag);
+            remove_client(self, sender);
+            update_priority(self);
+            sleep_ticks(sender, msg->num_of_ticks);
+            ENABLE_INTR(flag);
         }
     }
     become_zombie();
@@ -49,14 +454,46 @@ void timer_process(PROCESS self, PARAM param)
 
 void sleep(int ticks)
 {
-    Timer_Message   msg;
-    msg.num_of_ticks = ticks;
-    send(timer_port, &msg);
+    volatile int    flag;
+
+    if (ticks <= 0)
+        return;
+    DISABLE_INTR(flag);
+    remove_ready_queue(active_proc);
+    sleep_ticks(active_proc, ticks);
+    resign();
+    ENABLE_INTR(flag);
+}
+
+
+/* 
+ * Forgets all pending timeouts. Called by init_process() since the
+ * list refers to PCB's.
+ */
+void init_timeouts()
+{
+    timeout_list = NULL;
 }
 
 
 void init_timer()
 {
+    volatile int    flag;
+
+    /* 
+     * Program channel 0 of the PIT as rate generator (mode 2) with
+     * PIT_DIVISOR, instead of the BIOS default of 18.2 Hz.
+     */
+    DISABLE_INTR(flag);
+    program_pit(2, PIT_DIVISOR);
+    /* The APIC timer, if any, has no tickless mode */
+    pit_programmed = !start_apic_timer();
+    tickless_ticks = 0;
+    timer_ticks = 0;
+    calibration_tsc = 0;
+    cycles_per_tick = 0;
+    ENABLE_INTR(flag);
+
     timer_port = create_process(timer_process, 6, 0, "Timer process");
     resign();
 }
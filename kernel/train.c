@@ -5,8 +5,11 @@
 
 #include <kernel.h>
 
-/// Number of ticks to sleep for after each command.
-#define COOLDOWN 15
+/// Minimum time in milliseconds between the start of two commands.
+#define COOLDOWN 825
+
+/// CPU time in milliseconds needed to issue one command.
+#define COMMAND_BUDGET 80
 
 /// Number of switches.
 #define SWITCHES 9
@@ -59,8 +62,12 @@ static configuration_t configurations[] = {
     (configuration_t){ 16, 8, train_handler_cfg4 }
 };
 
+/// TRUE if the train process runs as real-time process.
+static BOOL realtime = FALSE;
+
 /**
- * Sends the command to the COM port and sleeps for COOLDOWN ticks.
+ * Sends the command to the COM port and sleeps until COOLDOWN
+ * milliseconds have passed since the command was issued.
  */
 static void train_send_command(COM_Message message);
 
@@ -125,6 +132,12 @@ void train_process(PROCESS self, PARAM param)
     zomboni_state_t zomboni;
     configuration_t* config = NULL;
 
+    // One command per COOLDOWN period, issued before the period ends.
+    realtime = set_realtime(MS_TO_TICKS(COOLDOWN), MS_TO_TICKS(COOLDOWN),
+                            MS_TO_TICKS(COMMAND_BUDGET));
+    if (!realtime)
+        wm_print(window, "Warning: no real-time guarantees.\n");
+
     wm_print(window, "Initializing Track...");
     train_initialize_track();
     wm_print(window, " Done.\n");
@@ -159,8 +172,13 @@ void init_train()
 
 void train_send_command(COM_Message message)
 {
+    unsigned start = get_ticks();
+
     send(com_port, &message);
-    sleep(COOLDOWN);
+    if (realtime)
+        wait_for_next_period();
+    else
+        sleep(MS_TO_TICKS(COOLDOWN) - (int) (get_ticks() - start));
 }
 
 void train_change_direction()
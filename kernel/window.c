@@ -9,6 +9,12 @@
 
 WORD            default_color = 0x0f;
 
+/*
+ * Serializes all writers of the screen. Scrolling a window takes a while,
+ * so this is a mutex rather than a DISABLE_INTR() section.
+ */
+static MUTEX    screen_lock = MUTEX_INIT;
+
 
 
 void poke_screen(int x, int y, WORD ch)
@@ -25,15 +31,13 @@ WORD peek_screen(int x, int y)
 
 
 
-void scroll_window(WINDOW * wnd)
+static void scroll_window_unlocked(WINDOW * wnd)
 {
     int             x,
                     y;
     int             wx,
                     wy;
-    volatile int    flag;
 
-    DISABLE_INTR(flag);
     for (y = 0; y < wnd->height - 1; y++) {
         wy = wnd->y + y;
         for (x = 0; x < wnd->width; x++) {
@@ -49,7 +53,14 @@ void scroll_window(WINDOW * wnd)
     }
     wnd->cursor_x = 0;
     wnd->cursor_y = wnd->height - 1;
-    ENABLE_INTR(flag);
+}
+
+
+void scroll_window(WINDOW * wnd)
+{
+    mutex_lock(&screen_lock);
+    scroll_window_unlocked(wnd);
+    mutex_unlock(&screen_lock);
 }
 
 
@@ -82,9 +93,7 @@ void clear_window(WINDOW * wnd)
     int             wx,
                     wy;
 
-    volatile int    flag;
-
-    DISABLE_INTR(flag);
+    mutex_lock(&screen_lock);
     wnd->cursor_x = 0;
     wnd->cursor_y = 0;
     for (y = 0; y < wnd->height; y++) {
@@ -95,15 +104,12 @@ void clear_window(WINDOW * wnd)
         }
     }
     show_cursor(wnd);
-    ENABLE_INTR(flag);
+    mutex_unlock(&screen_lock);
 }
 
 
-void output_char(WINDOW * wnd, unsigned char c)
+static void output_char_unlocked(WINDOW * wnd, unsigned char c)
 {
-    volatile int    flag;
-
-    DISABLE_INTR(flag);
     remove_cursor(wnd);
     switch (c) {
     case '\n':
@@ -133,17 +139,26 @@ void output_char(WINDOW * wnd, unsigned char c)
         break;
     }
     if (wnd->cursor_y == wnd->height)
-        scroll_window(wnd);
+        scroll_window_unlocked(wnd);
     show_cursor(wnd);
-    ENABLE_INTR(flag);
+}
+
+
+void output_char(WINDOW * wnd, unsigned char c)
+{
+    mutex_lock(&screen_lock);
+    output_char_unlocked(wnd, c);
+    mutex_unlock(&screen_lock);
 }
 
 
 
 void output_string(WINDOW * wnd, const char *str)
 {
+    mutex_lock(&screen_lock);
     while (*str != '\0')
-        output_char(wnd, *str++);
+        output_char_unlocked(wnd, *str++);
+    mutex_unlock(&screen_lock);
 }
 
 
@@ -396,6 +411,35 @@ void wprintf(WINDOW * wnd, const char *fmt, ...)
 }
 
 
+/*
+ * panic_printf
+ *----------------------------------------------------------------------------
+ * Clears wnd and prints to it without taking screen_lock. Only for the
+ * assertion, panic and exception paths: they run with interrupts
+ * disabled, possibly while screen_lock is held, and must not block.
+ */
+
+void panic_printf(WINDOW * wnd, const char *fmt, ...)
+{
+    va_list         argp;
+    char            buf[160];
+    char           *str = buf;
+    int             x,
+                    y;
+
+    va_start(argp, fmt);
+    vsprintf(buf, fmt, argp);
+    va_end(argp);
+    for (y = 0; y < wnd->height; y++)
+        for (x = 0; x < wnd->width; x++)
+            poke_screen(wnd->x + x, wnd->y + y, 0);
+    wnd->cursor_x = 0;
+    wnd->cursor_y = 0;
+    while (*str != '\0')
+        output_char_unlocked(wnd, *str++);
+}
+
+
 
 
 static WINDOW   kernel_window_def = { 0, 0, 80, 25, 0, 0, ' ' };
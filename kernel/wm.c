@@ -353,8 +353,8 @@ void process_window_manager(PROCESS self, PARAM data)
     clear_screen_buffer();
     copy_screen_buffer();
 
+    msg = receive(&sender);
     while (1) {
-        msg = receive(&sender);
         switch (msg->type) {
         case WM_TYPE_CREATE:
             wm_create_impl((WM_MSG_CREATE *) & msg->u);
@@ -368,7 +368,7 @@ void process_window_manager(PROCESS self, PARAM data)
         default:
             assert(0);
         }
-        reply(sender);
+        msg = reply_and_receive(sender, &sender);
     }
     become_zombie();
 }
@@ -27,5 +27,6 @@
 #define wprintf       lib_wprintf
 #define kernel_window lib_kernel_window
 #define kprintf       lib_kprintf
+#define panic_printf  lib_panic_printf
 
 #include "../kernel/window.c"
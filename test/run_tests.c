@@ -19,6 +19,8 @@ function_pointer tests[] =  {
     test_dispatcher_1,
     test_dispatcher_2,
     test_dispatcher_3,
+    test_dispatcher_4,
+    test_dispatcher_5,
     test_resign_1,
     test_resign_2,
     test_resign_3,
@@ -31,12 +33,25 @@ function_pointer tests[] =  {
     test_ipc_4,
     test_ipc_5,
     test_ipc_6,
+    test_ipc_7,
+    test_ipc_8,
+    test_ipc_9,
+    test_ipc_10,
+    test_ipc_11,
     test_isr_1,
     test_isr_2,
     test_isr_3,
+    test_isr_4,
     test_timer_1,
+    test_timer_2,
     test_com_1,
-    //test_fork_1,
+    test_fork_1,
+    test_process_1,
+    test_process_2,
+    test_process_3,
+    test_sync_1,
+    test_sync_2,
+    test_sync_3,
     NULL
 };
 
@@ -0,0 +1,71 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_dispatcher_4_process(PROCESS self, PARAM param)
+{
+    /*
+     * Since we don't do a context switch, this code will actually
+     * not be executed.
+     */
+    kprintf("Process: %s\n\n", self->name);
+    return_to_boot();
+}
+
+
+PROCESS test_dispatcher_4_create(char* name, int deadline)
+{
+    PROCESS proc;
+
+    proc = create_process(test_dispatcher_4_process, 3, 42, name)->owner;
+    proc->rt_period = deadline == 0 ? 0 : 100;
+    proc->deadline = deadline;
+    change_priority(proc, RT_PRIORITY);
+    return proc;
+}
+
+
+/*
+ * This test checks that the ready queue of RT_PRIORITY is sorted by
+ * deadline.
+ *  1. Processes A, B and C with the deadlines 30, 10 and 20 are made
+ *     ready at RT_PRIORITY in this order. dispatcher() returns B, and
+ *     the queue is B, C, A.
+ *  2. B is removed from the ready queue. dispatcher() returns C.
+ *  3. Process D, which is no real-time process but inherited
+ *     RT_PRIORITY, goes to the front of the queue.
+ */
+void test_dispatcher_4()
+{
+    PROCESS a, b, c, d;
+
+    test_reset();
+    kprintf("test_dispatcher_4\n");
+
+    a = test_dispatcher_4_create("EDF process A", 30);
+    b = test_dispatcher_4_create("EDF process B", 10);
+    c = test_dispatcher_4_create("EDF process C", 20);
+    check_num_proc_on_ready_queue(4);
+    if (test_result != 0)
+	test_failed(test_result);
+    if (dispatcher() != b)
+	test_failed(99);
+    if (ready_queue[RT_PRIORITY] != b || b->next != c || c->next != a
+	|| a->next != b || b->prev != a)
+	test_failed(99);
+    kprintf("Passed test 1 - returns EDF process B\n");
+
+    remove_ready_queue(b);
+    if (dispatcher() != c)
+	test_failed(99);
+    kprintf("Passed test 2 - returns EDF process C\n");
+
+    d = test_dispatcher_4_create("EDF process D", 0);
+    if (dispatcher() != d || d->next != c)
+	test_failed(99);
+    kprintf("Passed test 3 - returns EDF process D\n");
+
+    print_all_processes(kernel_window);
+    kprintf("\nAll pass!\n");
+}
@@ -0,0 +1,90 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_dispatcher_5_process_1(PROCESS self, PARAM param)
+{
+    /* Density 3/5 of the CPU */
+    if (!set_realtime(10, 5, 3))
+	test_failed(100);
+    if (self->priority != RT_PRIORITY || rt_load != 600)
+	test_failed(100);
+    check_sum += 1;
+
+    kprintf("%s: waiting for the next period...\n", self->name);
+    wait_for_next_period();
+    if (self->missed_deadlines != 0)
+	test_failed(101);
+
+    /* Exiting gives back our share of the CPU */
+    check_sum += 4;
+    become_zombie();
+    test_failed(100);
+}
+
+
+void test_dispatcher_5_process_2(PROCESS self, PARAM param)
+{
+    /* 1/2 of the CPU does not fit any more, 2/5 does */
+    if (set_realtime(10, 10, 5))
+	test_failed(100);
+    if (self->priority != 4 || self->rt_period != 0 || rt_load != 600)
+	test_failed(100);
+    if (!set_realtime(20, 20, 8))
+	test_failed(100);
+    if (self->priority != RT_PRIORITY || rt_load != 1000)
+	test_failed(100);
+    check_sum += 2;
+
+    /* Overrun our deadline */
+    kprintf("%s: running past the deadline...\n", self->name);
+    while ((int) (get_ticks() - self->deadline) <= 0);
+    wait_for_next_period();
+    if (self->missed_deadlines != 1 || missed_deadlines != 1)
+	test_failed(101);
+    check_process("RT process 1", STATE_ZOMBIE, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (rt_load != 400)
+	test_failed(100);
+
+    check_sum += 8;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks the admission of real-time processes and the
+ * accounting of missed deadlines.
+ *  1. Process 1 (priority 5) asks for 3 ticks within a deadline of 5
+ *     ticks every 10 ticks. It is admitted with 600 per mille of the
+ *     CPU and waits for its next period.
+ *  2. Process 2 (priority 4) asks for 500 per mille, which is refused,
+ *     and then for 400 per mille, which fills up the CPU.
+ *  3. Process 2 runs past its deadline. Meanwhile process 1 is released
+ *     again and exits, giving back its share of the CPU.
+ *  4. Process 2 finds one missed deadline when it waits for its next
+ *     period.
+ */
+void test_dispatcher_5()
+{
+    test_reset();
+    check_sum = 0;
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_dispatcher_5 ===\n");
+
+    create_process(test_dispatcher_5_process_1, 5, 0, "RT process 1");
+    create_process(test_dispatcher_5_process_2, 4, 0, "RT process 2");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 15)
+	test_failed(100);
+}
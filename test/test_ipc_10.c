@@ -0,0 +1,117 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+PORT test_ipc_10_ports[3];
+
+
+void test_ipc_10_check_message(PORT from, char* sender_name, int value)
+{
+    PROCESS sender;
+    int *data;
+
+    if (from == NULL)
+	data = (int*) receive(&sender);
+    else
+	data = (int*) receive_from(from, &sender);
+    kprintf("Receiver: received a message from %s, parameter = %d.\n",
+	    sender->name, *data);
+    if (string_compare(sender->name, sender_name) != 1 || *data != value)
+	test_failed(65);
+    check_process(sender_name, STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+}
+
+
+void test_ipc_10_receiver(PROCESS self, PARAM param)
+{
+    PORT first  = test_ipc_10_ports[0];
+    PORT second = test_ipc_10_ports[1];
+    PORT closed = test_ipc_10_ports[2];
+
+    check_process("Pending sender 1", STATE_MESSAGE_BLOCKED, FALSE);
+    check_process("Pending sender 2", STATE_MESSAGE_BLOCKED, FALSE);
+    check_process("Pending sender 3", STATE_MESSAGE_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    /* Only the open ports with a blocked sender are pending */
+    if (self->pending_ports != first || first->next_pending != second
+	|| second->next_pending != first || closed->pending)
+	test_failed(65);
+
+    /* receive_from() skips the first pending port */
+    test_ipc_10_check_message(second, "Pending sender 2", 2);
+    if (self->pending_ports != first || first->next_pending != first
+	|| second->pending)
+	test_failed(65);
+
+    test_ipc_10_check_message(NULL, "Pending sender 1", 1);
+    if (self->pending_ports != NULL || first->pending)
+	test_failed(65);
+
+    /* Opening the port makes its blocked sender pending */
+    open_port(closed);
+    if (self->pending_ports != closed || !closed->pending)
+	test_failed(65);
+    test_ipc_10_check_message(NULL, "Pending sender 3", 3);
+    if (self->pending_ports != NULL || closed->pending)
+	test_failed(65);
+
+    check_sum += 8;
+    return_to_boot();
+}
+
+
+void test_ipc_10_sender(PROCESS self, PARAM param)
+{
+    int data = param + 1;
+
+    kprintf("%s: sending a message...\n", self->name);
+    check_sum += 1 << param;
+    message(test_ipc_10_ports[param], &data);
+    test_failed(65);
+}
+
+
+/*
+ * This test checks receive_from() and the list of pending ports.
+ *  1. The receiver (priority 2) owns three ports. The third port is
+ *     closed.
+ *  2. Three senders (priority 4) send one message to each port and
+ *     block, since the receiver is not receiving yet.
+ *  3. The receiver finds the first two ports on its list of pending
+ *     ports. It receives from the second port with receive_from() and
+ *     from the first port with receive().
+ *  4. The receiver opens the third port, which becomes pending, and
+ *     receives the last message.
+ */
+void test_ipc_10()
+{
+    PROCESS receiver;
+
+    test_reset();
+    check_sum = 0;
+
+    test_ipc_10_ports[0] = create_process(test_ipc_10_receiver, 2, 0,
+					  "Receiver");
+    receiver = test_ipc_10_ports[0]->owner;
+    test_ipc_10_ports[1] = create_new_port(receiver);
+    test_ipc_10_ports[2] = create_new_port(receiver);
+    close_port(test_ipc_10_ports[2]);
+
+    create_process(test_ipc_10_sender, 4, 0, "Pending sender 1");
+    create_process(test_ipc_10_sender, 4, 1, "Pending sender 2");
+    create_process(test_ipc_10_sender, 4, 2, "Pending sender 3");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 15)
+	test_failed(65);
+}
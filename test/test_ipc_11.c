@@ -0,0 +1,125 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+PORT test_ipc_11_port;
+PORT test_ipc_11_go_port;
+
+char* test_ipc_11_names[] = {
+    "Ordered sender 1", "Ordered sender 2", "Ordered sender 3",
+    "Ordered sender 4"
+};
+
+int test_ipc_11_prios[] = { 3, 5, 4, 5 };
+
+/* Senders in the order in which they must be received */
+int test_ipc_11_order[] = { 1, 3, 2, 0 };
+
+
+void test_ipc_11_receiver(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    PROCESS p;
+    int *data;
+    int i;
+
+    kprintf("%s: waiting for the go...\n", self->name);
+    receive_from(test_ipc_11_go_port, &sender);
+
+    /* Highest priority first, FIFO within the same priority */
+    p = test_ipc_11_port->blocked_list_head;
+    for (i = 0; i < 4; i++) {
+	if (p == NULL || string_compare(p->name,
+			test_ipc_11_names[test_ipc_11_order[i]]) != 1)
+	    test_failed(66);
+	p = p->next_blocked;
+    }
+    if (p != NULL)
+	test_failed(66);
+
+    for (i = 0; i < 4; i++) {
+	data = (int*) receive_from(test_ipc_11_port, &sender);
+	kprintf("%s: received a message from %s, parameter = %d.\n",
+		self->name, sender->name, *data);
+	if (*data != test_ipc_11_order[i])
+	    test_failed(66);
+    }
+    if (test_ipc_11_port->blocked_list_head != NULL)
+	test_failed(66);
+
+    check_sum += 32;
+    return_to_boot();
+}
+
+
+void test_ipc_11_sender(PROCESS self, PARAM param)
+{
+    int data = param;
+
+    /*
+     * Create the next sender before blocking, so that the senders block
+     * in the order 3, 5, 4, 5 of their priorities.
+     */
+    if (param < 3)
+	create_process(test_ipc_11_sender, test_ipc_11_prios[param + 1],
+		       param + 1, test_ipc_11_names[param + 1]);
+
+    kprintf("%s: sending a message...\n", self->name);
+    check_sum += 1 << param;
+    message(test_ipc_11_port, &data);
+    test_failed(66);
+}
+
+
+void test_ipc_11_starter(PROCESS self, PARAM param)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+	check_process(test_ipc_11_names[i], STATE_MESSAGE_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 16;
+    kprintf("%s: sending the go...\n", self->name);
+    message(test_ipc_11_go_port, 0);
+    test_failed(66);
+}
+
+
+/*
+ * This test checks a port whose blocked list is ordered by priority.
+ *  1. The receiver (priority 6) owns two ports. The first is ordered by
+ *     priority. The receiver waits on the second port.
+ *  2. Four senders with the priorities 3, 5, 4 and 5 block on the first
+ *     port in this order. Each sender creates the next one first.
+ *  3. The starter (priority 2) wakes up the receiver through the
+ *     second port.
+ *  4. The receiver gets the messages of the senders with priority 5 in
+ *     the order they were sent, then priority 4, then priority 3.
+ */
+void test_ipc_11()
+{
+    PROCESS receiver;
+
+    test_reset();
+    check_sum = 0;
+
+    test_ipc_11_port = create_process(test_ipc_11_receiver, 6, 0,
+				      "Ordered receiver");
+    receiver = test_ipc_11_port->owner;
+    order_port_by_priority(test_ipc_11_port);
+    test_ipc_11_go_port = create_new_port(receiver);
+
+    create_process(test_ipc_11_starter, 2, 0, "Starter");
+    create_process(test_ipc_11_sender, test_ipc_11_prios[0], 0,
+		   test_ipc_11_names[0]);
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 63)
+	test_failed(66);
+}
@@ -0,0 +1,129 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_ipc_7_backend(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int *data;
+
+    /* The server is send blocked on us and lends us its priority */
+    if (self->priority != 5 || self->base_priority != 1)
+	test_failed(61);
+    check_process("Server", STATE_SEND_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    kprintf("%s: receiving a message...\n", self->name);
+    data = (int*) receive(&sender);
+    kprintf("%s: received a message from %s, parameter = %d.\n",
+	    self->name, sender->name, *data);
+    if (self->priority != 5)
+	test_failed(61);
+
+    check_sum += 2;
+    reply(sender);
+    test_failed(62);
+}
+
+
+void test_ipc_7_server(PROCESS self, PARAM param)
+{
+    PORT backend_port = (PORT) param;
+    PROCESS sender;
+    int *data;
+    int backend_data = 22;
+
+    /* The client is send blocked on our port */
+    if (self->priority != 5 || self->base_priority != 2)
+	test_failed(61);
+
+    kprintf("%s: receiving a message...\n", self->name);
+    data = (int*) receive(&sender);
+    kprintf("%s: received a message from %s, parameter = %d.\n",
+	    self->name, sender->name, *data);
+
+    /* The client keeps lending its priority until we reply */
+    check_process("Client", STATE_REPLY_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (self->priority != 5)
+	test_failed(61);
+
+    check_sum += 1;
+    kprintf("%s: sending a message to the backend...\n", self->name);
+    send(backend_port, &backend_data);
+
+    /* The backend replied and gave back what we lent it */
+    if (find_process_by_name("Backend")->priority != 1)
+	test_failed(62);
+    check_process("Backend", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 4;
+    reply(sender);
+    test_failed(62);
+}
+
+
+void test_ipc_7_client(PROCESS self, PARAM param)
+{
+    PORT server_port = (PORT) param;
+    PROCESS server;
+    int data = 11;
+
+    kprintf("%s: sending a message to the server...\n", self->name);
+    send(server_port, &data);
+
+    /* The server replied and is back at its own priority */
+    server = find_process_by_name("Server");
+    if (server->priority != 2)
+	test_failed(62);
+    check_process("Server", STATE_READY, TRUE);
+    check_process("Backend", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 8;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that a client lends its priority along a send/reply
+ * chain and that the priority is given back on reply.
+ *  1. The client (priority 5) sends to the server (priority 2), which
+ *     is not receiving yet. The server inherits priority 5.
+ *  2. The server receives the message and sends to the backend
+ *     (priority 1), which inherits priority 5 in turn.
+ *  3. The backend receives and replies. It drops back to priority 1.
+ *  4. The server replies to the client and drops back to priority 2.
+ */
+void test_ipc_7()
+{
+    PORT backend_port;
+    PORT server_port;
+
+    test_reset();
+    check_sum = 0;
+
+    backend_port = create_process(test_ipc_7_backend, 1, 0, "Backend");
+    server_port = create_process(test_ipc_7_server, 2,
+				 (PARAM) backend_port, "Server");
+    create_process(test_ipc_7_client, 5, (PARAM) server_port, "Client");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 15)
+	test_failed(62);
+}
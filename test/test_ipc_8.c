@@ -0,0 +1,100 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_ipc_8_server(PROCESS self, PARAM param)
+{
+    PROCESS sender;
+    int *data;
+
+    kprintf("%s: receiving a message...\n", self->name);
+    data = (int*) receive(&sender);
+    kprintf("%s: received a message from %s, parameter = %d.\n",
+	    self->name, sender->name, *data);
+
+    check_process("Client 1", STATE_REPLY_BLOCKED, FALSE);
+    check_process("Client 2", STATE_SEND_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 1;
+    kprintf("%s: exiting without a reply...\n", self->name);
+    become_zombie();
+    test_failed(91);
+}
+
+
+void test_ipc_8_client_1(PROCESS self, PARAM param)
+{
+    PORT server_port = (PORT) param;
+    int data = 11;
+
+    kprintf("%s: calling the server...\n", self->name);
+    if (call(server_port, &data) != NULL)
+	test_failed(63);
+    if (self->wake_reason != WAKE_PEER_EXITED)
+	test_failed(63);
+    if (server_port->used)
+	test_failed(63);
+
+    /* Messages to the port of an exited process are dropped */
+    message(server_port, &data);
+    if (send_timeout(server_port, &data, 10))
+	test_failed(63);
+
+    check_process("Client 2", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 2;
+    become_zombie();
+    test_failed(91);
+}
+
+
+void test_ipc_8_client_2(PROCESS self, PARAM param)
+{
+    PORT server_port = (PORT) param;
+    int data = 22;
+
+    kprintf("%s: calling the server...\n", self->name);
+    if (call(server_port, &data) != NULL)
+	test_failed(63);
+    if (self->wake_reason != WAKE_PEER_EXITED)
+	test_failed(63);
+
+    check_sum += 4;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that clients of a server that exits are woken up.
+ *  1. Client 1 (priority 5) and client 2 (priority 4) call the server
+ *     (priority 2) before it receives.
+ *  2. The server receives the message of client 1 and exits without
+ *     replying.
+ *  3. Both clients wake up with WAKE_PEER_EXITED: client 1 waited for
+ *     a reply, client 2 was still send blocked.
+ */
+void test_ipc_8()
+{
+    PORT server_port;
+
+    test_reset();
+    check_sum = 0;
+
+    server_port = create_process(test_ipc_8_server, 2, 0, "Exiting server");
+    create_process(test_ipc_8_client_1, 5, (PARAM) server_port, "Client 1");
+    create_process(test_ipc_8_client_2, 4, (PARAM) server_port, "Client 2");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(63);
+}
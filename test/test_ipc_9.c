@@ -0,0 +1,124 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_ipc_9_check_message(char* sender_name, int value)
+{
+    PROCESS sender;
+    int *data;
+
+    data = (int*) receive(&sender);
+    kprintf("Receiver: received a message from %s, parameter = %d.\n",
+	    sender->name, *data);
+    if (string_compare(sender->name, sender_name) != 1 || *data != value)
+	test_failed(64);
+}
+
+
+void test_ipc_9_receiver(PROCESS self, PARAM param)
+{
+    PORT port = self->first_port;
+
+    check_process("Buffer sender 1", STATE_MESSAGE_BLOCKED, FALSE);
+    check_process("Buffer sender 2", STATE_MESSAGE_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (port->queue_count != 2)
+	test_failed(64);
+
+    /* Each receive() moves the first blocked sender into the ring */
+    test_ipc_9_check_message("Buffer sender 1", 1);
+    check_process("Buffer sender 1", STATE_READY, TRUE);
+    check_process("Buffer sender 2", STATE_MESSAGE_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    test_ipc_9_check_message("Buffer sender 1", 2);
+    check_process("Buffer sender 2", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    test_ipc_9_check_message("Buffer sender 1", 3);
+    test_ipc_9_check_message("Buffer sender 2", 4);
+    if (port->queue_count != 0 || port->blocked_list_head != NULL)
+	test_failed(64);
+
+    check_sum += 4;
+    return_to_boot();
+}
+
+
+void test_ipc_9_sender_1(PROCESS self, PARAM param)
+{
+    PORT receiver_port = (PORT) param;
+    int data;
+
+    /* The first two messages are copied into the ring */
+    kprintf("%s: sending messages 1 and 2...\n", self->name);
+    data = 1;
+    message(receiver_port, &data);
+    data = 2;
+    message(receiver_port, &data);
+    check_sum += 1;
+
+    /* The ring is full now */
+    kprintf("%s: sending message 3...\n", self->name);
+    data = 3;
+    message(receiver_port, &data);
+    test_failed(64);
+}
+
+
+void test_ipc_9_sender_2(PROCESS self, PARAM param)
+{
+    PORT receiver_port = (PORT) param;
+    int data = 4;
+
+    check_process("Buffer sender 1", STATE_MESSAGE_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 2;
+    kprintf("%s: sending message 4...\n", self->name);
+    message(receiver_port, &data);
+    test_failed(64);
+}
+
+
+/*
+ * This test checks buffered messages.
+ *  1. The receiver (priority 2) gets a ring of two messages.
+ *  2. Sender 1 (priority 5) sends messages 1 and 2, which are copied
+ *     into the ring without blocking. Message 3 finds the ring full and
+ *     sender 1 blocks.
+ *  3. Sender 2 (priority 5) sends message 4. It must not overtake
+ *     sender 1 and blocks behind it.
+ *  4. The receiver receives the messages in the order 1, 2, 3, 4. Every
+ *     receive() makes room for the first blocked sender.
+ */
+void test_ipc_9()
+{
+    PORT receiver_port;
+
+    test_reset();
+    check_sum = 0;
+
+    receiver_port = create_process(test_ipc_9_receiver, 2, 0, "Receiver");
+    create_message_queue(receiver_port, 2, sizeof(int));
+    create_process(test_ipc_9_sender_1, 5, (PARAM) receiver_port,
+		   "Buffer sender 1");
+    create_process(test_ipc_9_sender_2, 5, (PARAM) receiver_port,
+		   "Buffer sender 2");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(64);
+}
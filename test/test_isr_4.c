@@ -0,0 +1,94 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+#define TEST_ISR_4_IRQ  IRQ_VECTOR(5)
+
+
+void test_isr_4_check_stats(unsigned delivered, unsigned coalesced,
+			    unsigned lost)
+{
+    IRQ_STATS *stats = &irq_stats[TEST_ISR_4_IRQ - IRQ_BASE];
+
+    if (stats->delivered != delivered || stats->coalesced != coalesced
+	|| stats->lost != lost) {
+	kprintf("delivered = %d, coalesced = %d, lost = %d\n",
+		stats->delivered, stats->coalesced, stats->lost);
+	test_failed(74);
+    }
+}
+
+
+void test_isr_4_waiter(PROCESS self, PARAM param)
+{
+    /* Nobody waited on the line yet, so the IRQ is lost */
+    asm("int $0x65");
+    test_isr_4_check_stats(0, 0, 1);
+
+    kprintf("%s: waiting for IRQ 5...\n", self->name);
+    if (wait_for_interrupt(TEST_ISR_4_IRQ) != 1)
+	test_failed(74);
+    test_isr_4_check_stats(1, 0, 1);
+    check_sum += 2;
+
+    /* The line stays armed; IRQs are latched while we are busy */
+    asm("int $0x65");
+    asm("int $0x65");
+    asm("int $0x65");
+    check_process("IRQ raiser", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (wait_for_interrupt(TEST_ISR_4_IRQ) != 3)
+	test_failed(74);
+    test_isr_4_check_stats(2, 2, 1);
+
+    check_sum += 4;
+    return_to_boot();
+}
+
+
+void test_isr_4_raiser(PROCESS self, PARAM param)
+{
+    check_process("IRQ waiter", STATE_INTR_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 1;
+    kprintf("%s: raising IRQ 5...\n", self->name);
+    asm("int $0x65");
+    test_failed(74);
+}
+
+
+/*
+ * This test checks how IRQs are latched and counted. IRQ 5 is raised
+ * in software with "int $0x65".
+ *  1. The waiter (priority 5) raises the IRQ before anybody waited on
+ *     the line. The IRQ is lost.
+ *  2. The waiter blocks in wait_for_interrupt(). The raiser (priority
+ *     4) raises the IRQ, which wakes up the waiter right away.
+ *  3. The waiter raises the IRQ three times. They are latched and the
+ *     next wait_for_interrupt() returns 3 without blocking: one
+ *     delivery, two coalesced.
+ */
+void test_isr_4()
+{
+    test_reset();
+    check_sum = 0;
+
+    init_interrupts();
+    kprintf("=== test_isr_4 ===\n");
+
+    create_process(test_isr_4_waiter, 5, 0, "IRQ waiter");
+    create_process(test_isr_4_raiser, 4, 0, "IRQ raiser");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(74);
+}
@@ -0,0 +1,65 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_process_1_exiting(PROCESS self, PARAM param)
+{
+    check_process("Sibling", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 1;
+    kprintf("%s: exiting...\n", self->name);
+    become_zombie();
+    test_failed(91);
+}
+
+
+void test_process_1_sibling(PROCESS self, PARAM param)
+{
+    PROCESS exiting = (PROCESS) param;
+
+    kprintf("%s: running.\n", self->name);
+    check_process("Exiting", STATE_ZOMBIE, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    /* The PCB is only reclaimed once somebody reaps the zombies */
+    if (!exiting->used)
+	test_failed(91);
+    if (ready_queue[3] != self || self->next != self)
+	test_failed(91);
+
+    check_sum += 2;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks that a process can exit while another process of the
+ * same priority is ready.
+ *  1. The boot process creates the exiting process and the sibling,
+ *     both with priority 3.
+ *  2. The exiting process runs first and calls become_zombie().
+ *  3. Round robin picks the sibling, which finds the exiting process
+ *     off the ready queue in STATE_ZOMBIE.
+ */
+void test_process_1()
+{
+    PROCESS exiting;
+
+    test_reset();
+    check_sum = 0;
+
+    exiting = create_process(test_process_1_exiting, 3, 0, "Exiting")->owner;
+    create_process(test_process_1_sibling, 3, (PARAM) exiting, "Sibling");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 3)
+	test_failed(91);
+}
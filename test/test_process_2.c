@@ -0,0 +1,73 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_process_2_child(PROCESS self, PARAM param)
+{
+    check_process("Parent", STATE_WAIT_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 1;
+    kprintf("%s: exiting...\n", self->name);
+    become_zombie();
+    test_failed(91);
+}
+
+
+void test_process_2_parent(PROCESS self, PARAM param)
+{
+    PORT child_port;
+    PROCESS child;
+    PORT port;
+
+    child_port = create_process(test_process_2_child, 2, 0, "Child");
+    child = child_port->owner;
+
+    kprintf("%s: waiting for the child...\n", self->name);
+    wait(child);
+
+    /* wait() reaped the child and released its port */
+    kprintf("%s: child has exited.\n", self->name);
+    if (check_sum != 1)
+	test_failed(92);
+    if (child->used || child_port->used)
+	test_failed(92);
+
+    /* Waiting for a child that is gone returns right away */
+    wait(child);
+    check_sum += 2;
+
+    /* The next process gets the PCB and the port of the child */
+    port = create_process(test_process_2_child, 2, 0, "Reused");
+    if (port != child_port || port->owner != child)
+	test_failed(92);
+
+    check_sum += 4;
+    return_to_boot();
+}
+
+
+/*
+ * This test checks wait() and the reclamation of exited processes.
+ *  1. The parent (priority 3) creates the child (priority 2) and waits
+ *     for it.
+ *  2. The child exits, which makes the parent ready again.
+ *  3. The parent checks that the PCB and the port of the child were
+ *     freed and that the next process it creates reuses them.
+ */
+void test_process_2()
+{
+    test_reset();
+    check_sum = 0;
+
+    create_process(test_process_2_parent, 3, 0, "Parent");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(92);
+}
@@ -0,0 +1,70 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+MUTEX test_process_3_mutex;
+
+
+void test_process_3_waiter(PROCESS self, PARAM param)
+{
+    kprintf("%s: locking the mutex...\n", self->name);
+    mutex_lock(&test_process_3_mutex);
+
+    /* The owner exited and the mutex was handed over to us */
+    kprintf("%s: got the mutex.\n", self->name);
+    if (test_process_3_mutex.owner != self)
+	test_failed(95);
+    check_process("Holder", STATE_ZOMBIE, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 2;
+    mutex_unlock(&test_process_3_mutex);
+    return_to_boot();
+}
+
+
+void test_process_3_holder(PROCESS self, PARAM param)
+{
+    mutex_lock(&test_process_3_mutex);
+    create_process(test_process_3_waiter, 5, 0, "Mutex waiter");
+    resign();
+
+    check_process("Mutex waiter", STATE_MUTEX_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (self->priority != 5)
+	test_failed(96);
+
+    check_sum += 1;
+    kprintf("%s: exiting with the mutex locked...\n", self->name);
+    become_zombie();
+    test_failed(91);
+}
+
+
+/*
+ * This test checks that a process that exits gives up its mutexes.
+ *  1. The holder (priority 3) locks the mutex and creates the waiter
+ *     (priority 5), which blocks on the mutex.
+ *  2. The holder exits without unlocking the mutex.
+ *  3. The waiter gets the mutex and runs.
+ */
+void test_process_3()
+{
+    test_reset();
+    init_mutex(&test_process_3_mutex);
+    check_sum = 0;
+
+    create_process(test_process_3_holder, 3, 0, "Holder");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 3)
+	test_failed(95);
+}
@@ -0,0 +1,86 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+MUTEX test_sync_1_mutex;
+
+
+void test_sync_1_waiter(PROCESS self, PARAM param)
+{
+    PROCESS owner = (PROCESS) param;
+
+    kprintf("%s: locking the mutex...\n", self->name);
+    mutex_lock(&test_sync_1_mutex);
+
+    /* The owner handed the mutex over and gave back our priority */
+    kprintf("%s: got the mutex.\n", self->name);
+    if (test_sync_1_mutex.owner != self)
+	test_failed(95);
+    check_process("Owner", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (owner->priority != 3)
+	test_failed(96);
+
+    check_sum += 4;
+    mutex_unlock(&test_sync_1_mutex);
+    if (test_sync_1_mutex.owner != NULL)
+	test_failed(95);
+
+    return_to_boot();
+}
+
+
+void test_sync_1_owner(PROCESS self, PARAM param)
+{
+    kprintf("%s: locking the mutex...\n", self->name);
+    mutex_lock(&test_sync_1_mutex);
+    if (test_sync_1_mutex.owner != self)
+	test_failed(95);
+    if (mutex_trylock(&test_sync_1_mutex))
+	test_failed(95);
+    check_sum += 1;
+
+    create_process(test_sync_1_waiter, 5, (PARAM) self, "Waiter");
+    resign();
+
+    /* The waiter blocked and lent us its priority */
+    check_process("Waiter", STATE_MUTEX_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (self->priority != 5 || self->base_priority != 3)
+	test_failed(96);
+
+    check_sum += 2;
+    kprintf("%s: unlocking the mutex...\n", self->name);
+    mutex_unlock(&test_sync_1_mutex);
+    test_failed(95);
+}
+
+
+/*
+ * This test checks mutexes and the priority a waiter lends to the owner.
+ *  1. The owner (priority 3) locks the mutex and creates the waiter
+ *     (priority 5), which blocks on the mutex.
+ *  2. The owner now runs with priority 5. It unlocks the mutex, which
+ *     passes it to the waiter and drops the owner back to priority 3.
+ *  3. The waiter runs right away, owning the mutex.
+ */
+void test_sync_1()
+{
+    test_reset();
+    init_mutex(&test_sync_1_mutex);
+    check_sum = 0;
+
+    create_process(test_sync_1_owner, 3, 0, "Owner");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(95);
+}
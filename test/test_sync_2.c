@@ -0,0 +1,77 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+SEMAPHORE test_sync_2_sem;
+
+
+void test_sync_2_consumer(PROCESS self, PARAM param)
+{
+    kprintf("%s: taking the first unit...\n", self->name);
+    semaphore_wait(&test_sync_2_sem);
+    if (test_sync_2_sem.count != 0)
+	test_failed(97);
+    check_sum += 1;
+
+    kprintf("%s: taking the second unit...\n", self->name);
+    semaphore_wait(&test_sync_2_sem);
+
+    /* The producer passed its unit straight to us */
+    kprintf("%s: got the second unit.\n", self->name);
+    if (test_sync_2_sem.count != 0)
+	test_failed(97);
+    check_process("Producer", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 4;
+    return_to_boot();
+}
+
+
+void test_sync_2_producer(PROCESS self, PARAM param)
+{
+    check_process("Consumer", STATE_SEM_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (test_sync_2_sem.count != 0)
+	test_failed(97);
+
+    check_sum += 2;
+    kprintf("%s: signalling the semaphore...\n", self->name);
+    semaphore_signal(&test_sync_2_sem);
+    test_failed(97);
+}
+
+
+/*
+ * This test checks semaphores.
+ *  1. The boot process signals an empty semaphore, leaving one unit.
+ *  2. The consumer (priority 5) takes that unit and blocks on the
+ *     second semaphore_wait().
+ *  3. The producer (priority 3) signals the semaphore. The unit goes
+ *     to the consumer, which runs right away.
+ */
+void test_sync_2()
+{
+    test_reset();
+    init_semaphore(&test_sync_2_sem, 0);
+    check_sum = 0;
+
+    semaphore_signal(&test_sync_2_sem);
+    if (test_sync_2_sem.count != 1)
+	test_failed(97);
+
+    create_process(test_sync_2_consumer, 5, 0, "Consumer");
+    create_process(test_sync_2_producer, 3, 0, "Producer");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(97);
+}
@@ -0,0 +1,93 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+MUTEX     test_sync_3_mutex;
+CONDITION test_sync_3_cond;
+BOOL      test_sync_3_ready;
+
+
+void test_sync_3_waiter(PROCESS self, PARAM param)
+{
+    mutex_lock(&test_sync_3_mutex);
+    while (!test_sync_3_ready) {
+	kprintf("%s: waiting for the condition...\n", self->name);
+	condition_wait(&test_sync_3_cond, &test_sync_3_mutex);
+    }
+
+    /* condition_wait() returned with the mutex locked again */
+    kprintf("%s: condition is true.\n", self->name);
+    if (test_sync_3_mutex.owner != self)
+	test_failed(98);
+    check_process("Signaller", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 4;
+    mutex_unlock(&test_sync_3_mutex);
+    return_to_boot();
+}
+
+
+void test_sync_3_signaller(PROCESS self, PARAM param)
+{
+    /* The waiter must have released the mutex while waiting */
+    check_process("Waiter", STATE_COND_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+    if (test_sync_3_mutex.owner != NULL)
+	test_failed(98);
+
+    mutex_lock(&test_sync_3_mutex);
+    test_sync_3_ready = TRUE;
+    kprintf("%s: signalling the condition...\n", self->name);
+    condition_signal(&test_sync_3_cond);
+    check_process("Waiter", STATE_READY, TRUE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    /* The waiter runs, but has to wait for the mutex */
+    resign();
+    check_process("Waiter", STATE_MUTEX_BLOCKED, FALSE);
+    if (test_result != 0) {
+	print_all_processes(kernel_window);
+	test_failed(test_result);
+    }
+
+    check_sum += 2;
+    mutex_unlock(&test_sync_3_mutex);
+    test_failed(98);
+}
+
+
+/*
+ * This test checks condition variables.
+ *  1. The waiter (priority 5) locks the mutex and waits on the
+ *     condition, which unlocks the mutex.
+ *  2. The signaller (priority 3) locks the mutex, sets the condition and
+ *     signals it. The waiter wakes up but blocks on the mutex.
+ *  3. The signaller unlocks the mutex. The waiter gets it and runs.
+ */
+void test_sync_3()
+{
+    test_reset();
+    init_mutex(&test_sync_3_mutex);
+    init_condition(&test_sync_3_cond);
+    test_sync_3_ready = FALSE;
+    check_sum = 0;
+
+    create_process(test_sync_3_waiter, 5, 0, "Waiter");
+    create_process(test_sync_3_signaller, 3, 0, "Signaller");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 6)
+	test_failed(98);
+}
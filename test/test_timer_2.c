@@ -0,0 +1,90 @@
+
+#include <kernel.h>
+#include <test.h>
+
+
+void test_timer_2_spinner(PROCESS self, PARAM param)
+{
+    /* Keeps the boot process away, but never receives */
+    while (42);
+}
+
+
+void test_timer_2_process(PROCESS self, PARAM param)
+{
+    PORT     spinner_port = (PORT) param;
+    PROCESS  spinner = spinner_port->owner;
+    PROCESS  sender;
+    void    *data;
+    int      value = 42;
+    unsigned start;
+
+    kprintf("%s: sending with a timeout...\n", self->name);
+    start = get_ticks();
+    if (send_timeout(spinner_port, &value, 3))
+	test_failed(81);
+    if (self->wake_reason != WAKE_TIMEOUT || get_ticks() - start < 3)
+	test_failed(81);
+    /* The spinner gave back the priority we lent it */
+    if (spinner->priority != 2 || spinner_port->blocked_list_head != NULL)
+	test_failed(81);
+    check_sum += 1;
+
+    kprintf("%s: receiving with a timeout...\n", self->name);
+    start = get_ticks();
+    sender = self;
+    data = receive_timeout(&sender, 3);
+    if (data != NULL || sender != NULL)
+	test_failed(81);
+    if (self->wake_reason != WAKE_TIMEOUT || get_ticks() - start < 3)
+	test_failed(81);
+    check_sum += 2;
+
+    kprintf("%s: waiting for an interrupt with a timeout...\n", self->name);
+    start = get_ticks();
+    if (wait_for_interrupt_timeout(IRQ_VECTOR(5), 3) != 0)
+	test_failed(81);
+    if (self->wake_reason != WAKE_TIMEOUT || get_ticks() - start < 3)
+	test_failed(81);
+    if (interrupt_table[IRQ_VECTOR(5)] != NULL)
+	test_failed(81);
+    check_sum += 4;
+
+    return_to_boot();
+}
+
+
+/*
+ * This test checks the timeouts of send(), receive() and
+ * wait_for_interrupt().
+ *  1. The spinner (priority 2) loops forever and never receives.
+ *  2. The test process (priority 5) sends to the spinner with a timeout
+ *     of 3 ticks. The send times out and the spinner gives back the
+ *     priority it inherited.
+ *  3. The test process receives with a timeout of 3 ticks. Nobody sends
+ *     and receive_timeout() returns NULL.
+ *  4. The test process waits for IRQ 5, which never occurs, with a
+ *     timeout of 3 ticks. wait_for_interrupt_timeout() returns 0.
+ */
+void test_timer_2()
+{
+    PORT spinner_port;
+
+    test_reset();
+    check_sum = 0;
+
+    init_interrupts();
+    init_null_process();
+    init_timer();
+
+    kprintf("=== test_timer_2 ===\n");
+
+    spinner_port = create_process(test_timer_2_spinner, 2, 0, "Spinner");
+    create_process(test_timer_2_process, 5, (PARAM) spinner_port,
+		   "Timeout process");
+    resign();
+
+    kprintf("Back to boot.\n");
+    if (check_sum != 7)
+	test_failed(81);
+}